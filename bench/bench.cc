@@ -0,0 +1,472 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// Micro and end-to-end benchmarks. Each result is printed as one JSON object per line so runs can
+// be diffed or loaded by a regression script:
+//     {"name": "...", "iterations": N, "ns_per_op": X, "mrays_per_s": Y, "samples_per_s": Z}
+// with null for a rate when the run traced nothing or took no measurable time.
+// Usage: bench [-filter substring] [-time seconds] [-t threads] [-w width] [-h height] [-s samples]
+//              [-sampler name] [-rr]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bvh.h"
+#include "camera.h"
+#include "closed_dispatch.h"
+#include "compact_scene.h"
+#include "hitable_list.h"
+#include "incremental.h"
+#include "material.h"
+#include "mesh.h"
+#include "packet.h"
+#include "random.h"
+#include "render.h"
+#include "sampler.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "wavefront.h"
+
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_options {
+    const char *filter = 0;
+    double min_seconds = 0.25;
+    int threads = default_thread_count();
+    int nx = 200;
+    int ny = 133;
+    int ns = 4;
+    sampler_type sampling = sampler_random;     // for the scene benchmarks
+    path_policy paths;                          // likewise
+};
+
+static bench_options options;
+static volatile float sink;
+
+
+bool selected(const char *name) {
+    return !options.filter || strstr(name, options.filter);
+}
+
+
+// Prints a rate, or null when there is nothing to divide by, since JSON has no inf or nan.
+void print_rate(const char *key, double value, bool defined, const char *format) {
+    printf(", \"%s\": ", key);
+    if (defined) printf(format, value);
+    else printf("null");
+}
+
+
+void report(const char *name, long long iterations, double seconds, double rays, double samples) {
+    printf("{\"name\": \"%s\", \"iterations\": %lld", name, iterations);
+    print_rate("ns_per_op", seconds * 1e9 / double(iterations), iterations > 0 && seconds > 0, "%.3f");
+    print_rate("mrays_per_s", rays / seconds / 1e6, seconds > 0, "%.3f");
+    print_rate("samples_per_s", samples / seconds, seconds > 0, "%.1f");
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+// Runs op(batch) repeatedly, doubling the batch until the run takes min_seconds. op returns a
+// value folded into sink so the work cannot be optimized away. Each op counts as one ray.
+template <typename Op>
+void run_micro(const char *name, Op op) {
+    if (!selected(name)) return;
+    long long batch = 1024;
+    for (;;) {
+        bench_clock::time_point start = bench_clock::now();
+        float acc = op(batch);
+        double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+        sink = acc;
+        if (seconds >= options.min_seconds || batch >= (1LL << 40)) {
+            report(name, batch, seconds, double(batch), 0);
+            return;
+        }
+        batch *= 2;
+    }
+}
+
+
+// A fixed pool of random rays aimed roughly at the origin, reused by the intersection benchmarks.
+std::vector<ray> make_rays(int n, float spread) {
+    std::vector<ray> rays(n);
+    for (int i = 0; i < n; i++) {
+        vec3 o(spread*(2*random_double()-1), 1 + random_double(), spread*(2*random_double()-1));
+        vec3 target(2*random_double()-1, random_double(), 2*random_double()-1);
+        rays[i] = ray(o + vec3(0, 0, 15), target - o - vec3(0, 0, 15));
+    }
+    return rays;
+}
+
+
+// Rings from pole to pole and segments around, wound counterclockwise from outside.
+void make_uv_sphere(triangle_mesh& mesh, const vec3& center, real radius, int rings, int segments) {
+    for (int i = 0; i <= rings; i++) {
+        real theta = M_PI*i / rings;
+        for (int j = 0; j < segments; j++) {
+            real phi = 2*M_PI*j / segments;
+            vec3 n(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi));
+            mesh.positions.push_back(center + radius*n);
+            mesh.normals.push_back(n);
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            uint32_t a = i*segments + j, b = i*segments + (j+1) % segments;
+            uint32_t c = b + segments, d = a + segments;
+            uint32_t tris[6] = { a, b, c, a, c, d };
+            mesh.indices.insert(mesh.indices.end(), tris, tris + 6);
+        }
+    }
+    mesh.build();
+}
+
+
+void micro_benchmarks(const scene_description& scene, const std::vector<material*>& mats,
+                      hitable_list *list) {
+    std::vector<ray> rays = make_rays(4096, 4);
+    const int mask = 4095;
+
+    run_micro("random_double", [](long long n) {
+        double acc = 0;
+        for (long long k = 0; k < n; k++)
+            acc += random_double();
+        return float(acc);
+    });
+
+    // The ball draws every lambertian bounce makes: rejection from thread_rng(), or mapped from
+    // each sampler's next dimensions.
+    const char *sampler_names[4] = { "unit_sphere_random", "unit_sphere_halton", "unit_sphere_sobol",
+                                     "unit_sphere_bluenoise" };
+    for (int k = 0; k < 4; k++) {
+        if (!selected(sampler_names[k])) continue;
+        const sampler *source = get_sampler(sampler_type(k));
+        run_micro(sampler_names[k], [&](long long n) {
+            float acc = 0;
+            for (long long i = 0; i < n; i++) {
+                if ((i & 7) == 0) begin_sample(source, int(i >> 3) & 1023, 0, uint32_t(i >> 13), 0);
+                acc += random_in_unit_sphere().x();
+            }
+            return acc;
+        });
+    }
+    begin_sample(0, 0, 0, 0, 0);
+
+    run_micro("vec3_ops", [&](long long n) {
+        vec3 acc(0,0,0);
+        for (long long k = 0; k < n; k++) {
+            const vec3& a = rays[k & mask].B;
+            const vec3& b = rays[(k+1) & mask].B;
+            acc += cross(a, b) * dot(a, b) + unit_vector(a) - b / 3.0f;
+        }
+        return acc.x() + acc.y() + acc.z();
+    });
+
+    camera cam = scene.make_camera(1.5f);
+    run_micro("camera_get_ray", [&](long long n) {
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            acc += cam.get_ray(float(random_double()), float(random_double())).B.x();
+        return acc;
+    });
+
+    sphere s(vec3(0, 1, 0), 1.0, mats[0]);
+    run_micro("sphere_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (s.hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+
+    run_micro("hitable_list_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (list->hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+
+    bvh tree(list->list, list->list_size);
+    run_micro("bvh_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (tree.hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+
+    std::unique_ptr<sphere_set> set(make_sphere_set(scene, mats));
+    run_micro("sphere_set_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (set->hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+    set.reset();
+
+    arena compact_mem;
+    std::unique_ptr<compact_sphere_set> compact(make_compact_sphere_set(scene, compact_mem));
+    run_micro("compact_set_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (compact->hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+    compact.reset();
+
+    // The middle sphere again as a 128x256 UV-sphere mesh, about 65k triangles.
+    triangle_mesh mesh;
+    make_uv_sphere(mesh, vec3(0, 1, 0), 1.0, 128, 256);
+    run_micro("triangle_mesh_hit", [&](long long n) {
+        hit_record rec;
+        float acc = 0;
+        for (long long k = 0; k < n; k++)
+            if (mesh.hit(rays[k & mask], 0.001, MAXFLOAT, rec)) acc += rec.t;
+        return acc;
+    });
+
+    // Scatter benchmarks reuse real hit records so the inputs look like rendering.
+    std::vector<std::pair<ray, hit_record> > hits;
+    for (const ray& r : rays) {
+        hit_record rec;
+        if (list->hit(r, 0.001, MAXFLOAT, rec))
+            hits.push_back(std::make_pair(r, rec));
+    }
+    if (hits.empty()) return;
+    lambertian lam(vec3(0.5, 0.5, 0.5));
+    metal met(vec3(0.7, 0.6, 0.5), 0.3);
+    dielectric glass(1.5);
+    const material *kinds[3] = { &lam, &met, &glass };
+    const char *names[3] = { "scatter_lambertian", "scatter_metal", "scatter_dielectric" };
+    for (int m = 0; m < 3; m++) {
+        const material *mat = kinds[m];
+        run_micro(names[m], [&](long long n) {
+            float acc = 0;
+            size_t nh = hits.size();
+            for (long long k = 0; k < n; k++) {
+                const std::pair<ray, hit_record>& h = hits[size_t(k) % nh];
+                vec3 attenuation;
+                ray scattered;
+                if (mat->scatter(h.first, h.second, attenuation, scattered))
+                    acc += scattered.B.x();
+            }
+            return acc;
+        });
+    }
+}
+
+
+// Renders the scene once with the default sphere_set, or the compact set, and reports the ray
+// and sample rates.
+void scene_benchmark(const char *name, int grid, bool compact = false) {
+    if (!selected(name)) return;
+    pcg32 saved = thread_rng();
+    thread_rng() = pcg32();
+    scene_description scene;
+    random_scene(scene, grid);
+    thread_rng() = saved;
+
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    bench_clock::time_point build_start = bench_clock::now();
+    std::unique_ptr<sphere_set> set(compact ? 0 : make_sphere_set(scene, mats));
+    std::unique_ptr<compact_sphere_set> compact_set(compact ? make_compact_sphere_set(scene, mem) : 0);
+    hitable *world = compact ? (hitable*)compact_set.get() : set.get();
+    double build = std::chrono::duration<double>(bench_clock::now() - build_start).count();
+    camera cam = scene.make_camera(float(options.nx) / float(options.ny));
+
+    render_settings settings;
+    settings.ns = options.ns;
+    settings.threads = options.threads;
+    settings.sampling = get_sampler(options.sampling);
+    settings.paths = options.paths;
+    framebuffer fb(options.nx, options.ny);
+    bench_clock::time_point start = bench_clock::now();
+    path_stats stats = render(cam, world, settings, fb);
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    report(name, stats.rays, seconds, double(stats.rays), double(stats.paths));
+    std::string build_name = std::string(name) + "_build";
+    report(build_name.c_str(), (long long)scene.num_spheres, build, 0, 0);
+}
+
+
+// The random scene with grid n through the recursive integrator, the wavefront one, which batches
+// each bounce's scatter() calls by material, or the closed one, which dispatches both hit() and
+// scatter() at compile time, all on the same sphere_set.
+void integrator_benchmark(const char *name, int grid, const char *integrator) {
+    if (!selected(name)) return;
+    pcg32 saved = thread_rng();
+    thread_rng() = pcg32();
+    scene_description scene;
+    random_scene(scene, grid);
+    thread_rng() = saved;
+
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    std::unique_ptr<sphere_set> set(make_sphere_set(scene, mats));
+    camera cam = scene.make_camera(float(options.nx) / float(options.ny));
+    render_settings settings;
+    settings.ns = options.ns;
+    settings.threads = options.threads;
+    settings.sampling = get_sampler(options.sampling);
+    settings.paths = options.paths;
+    std::vector<material_variant> variants = make_material_variants(scene);
+    framebuffer fb(options.nx, options.ny);
+    bench_clock::time_point start = bench_clock::now();
+    path_stats stats;
+    if (!strcmp(integrator, "wavefront"))
+        stats = render_wavefront(cam, set.get(), settings, fb);
+    else if (!strcmp(integrator, "closed"))
+        stats = render_closed(cam, *set, variants, settings, fb);
+    else
+        stats = render(cam, set.get(), settings, fb);
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    report(name, stats.rays, seconds, double(stats.rays), double(stats.paths));
+}
+
+
+// First hits only (no bounces) on the random scene, traced one ray at a time or in packets.
+void primary_benchmark(const char *name, bool packets) {
+    if (!selected(name)) return;
+    pcg32 saved = thread_rng();
+    thread_rng() = pcg32();
+    scene_description scene;
+    random_scene(scene);
+    thread_rng() = saved;
+
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    std::unique_ptr<sphere_set> set(make_sphere_set(scene, mats));
+    camera cam = scene.make_camera(float(options.nx) / float(options.ny));
+    render_settings settings;
+    settings.ns = options.ns;
+    settings.threads = options.threads;
+    settings.sampling = get_sampler(options.sampling);
+    settings.paths.max_depth = 0;
+    framebuffer fb(options.nx, options.ny);
+    bench_clock::time_point start = bench_clock::now();
+    path_stats stats = packets ? render_packets(cam, set.get(), settings, fb) : render(cam, set.get(), settings, fb);
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    report(name, stats.rays, seconds, double(stats.rays), double(stats.paths));
+}
+
+
+// The random scene through incremental_renderer: the first frame, which traces every tile and
+// records it, and re-renders after recoloring one small sphere or moving another. Each repeats
+// until min_seconds, the edits flipping back and forth, and is reported per ray re-traced.
+void incremental_benchmark() {
+    const char *names[3] = { "incremental_first", "incremental_recolor", "incremental_move" };
+    if (!selected(names[0]) && !selected(names[1]) && !selected(names[2])) return;
+    pcg32 saved = thread_rng();
+    thread_rng() = pcg32();
+    scene_description scene;
+    random_scene(scene);
+    thread_rng() = saved;
+
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    render_settings settings;
+    settings.ns = options.ns;
+    settings.threads = options.threads;
+    settings.sampling = get_sampler(options.sampling);
+    settings.paths = options.paths;
+    camera cam = scene.make_camera(float(options.nx) / float(options.ny));
+    framebuffer fb(options.nx, options.ny);
+    int recolor = int(scene.num_spheres) / 2, move = int(scene.num_spheres) / 3;
+    const scene_sphere& s = scene.spheres[move];
+    vec3 home(s.center[0], s.center[1], s.center[2]);
+    vec3 away = home + vec3(s.radius, 0, 0);
+    for (int k = 0; k < 3; k++) {
+        if (!selected(names[k])) continue;
+        std::unique_ptr<incremental_renderer> inc;
+        if (k > 0) {
+            inc.reset(new incremental_renderer(scene, mats, cam, settings, options.nx, options.ny));
+            inc->render(fb);
+        }
+        path_stats total;
+        double seconds = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (long long frame = 0; ; frame++) {
+            if (k == 0)
+                inc.reset(new incremental_renderer(scene, mats, cam, settings, options.nx, options.ny));
+            else if (k == 1)
+                inc->set_material(recolor, frame % 2 ? scene.spheres[recolor].material : scene.spheres[0].material);
+            else
+                inc->move_sphere(move, frame % 2 ? home : away, s.radius);
+            incremental_stats st = inc->render(fb);
+            total.add(st.paths);
+            seconds += st.seconds;
+            if (std::chrono::duration<double>(bench_clock::now() - start).count() >= options.min_seconds)
+                break;
+        }
+        report(names[k], total.rays, seconds, double(total.rays), double(total.paths));
+    }
+}
+
+
+int main(int argc, char **argv) {
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-filter") && a+1 < argc)
+            options.filter = argv[++a];
+        else if (!strcmp(argv[a], "-time") && a+1 < argc)
+            options.min_seconds = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-t") && a+1 < argc)
+            options.threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-w") && a+1 < argc)
+            options.nx = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-h") && a+1 < argc)
+            options.ny = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-s") && a+1 < argc)
+            options.ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-sampler") && a+1 < argc && parse_sampler_type(argv[a+1], options.sampling))
+            a++;
+        else if (!strcmp(argv[a], "-rr"))
+            options.paths.russian_roulette = true;
+        else {
+            fprintf(stderr, "usage: %s [-filter substring] [-time seconds] [-t threads] [-w width] [-h height] [-s samples]\n"
+                            "       [-sampler random|halton|sobol|bluenoise] [-rr]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    scene_description scene;
+    random_scene(scene);
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    hitable_list *list = make_hitable_list(scene, mats, mem);
+    micro_benchmarks(scene, mats, list);
+
+    // grid n gives about (2n)^2 spheres
+    scene_benchmark("scene_random", 11);
+    scene_benchmark("scene_10k", 50);
+    scene_benchmark("scene_100k", 158);
+    scene_benchmark("scene_1m", 500);
+    scene_benchmark("scene_1m_compact", 500, true);
+    integrator_benchmark("integrator_recursive", 11, "recursive");
+    integrator_benchmark("integrator_wavefront", 11, "wavefront");
+    integrator_benchmark("integrator_closed", 11, "closed");
+    integrator_benchmark("integrator_recursive_10k", 50, "recursive");
+    integrator_benchmark("integrator_wavefront_10k", 50, "wavefront");
+    integrator_benchmark("integrator_closed_10k", 50, "closed");
+    primary_benchmark("primary_single", false);
+    primary_benchmark("primary_packet", true);
+    incremental_benchmark();
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef AABBH
+#define AABBH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "ray.h"
+
+inline real ffmin(real a, real b) { return a < b ? a : b; }
+inline real ffmax(real a, real b) { return a > b ? a : b; }
+
+
+class aabb {
+    public:
+        aabb() {}
+        aabb(const vec3& a, const vec3& b) { _min = a; _max = b; }
+
+        vec3 min() const { return _min; }
+        vec3 max() const { return _max; }
+        vec3 centroid() const { return 0.5*(_min + _max); }
+
+        real surface_area() const {
+            vec3 d = _max - _min;
+            return 2*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        // Slab test with the reciprocal direction precomputed once per ray.
+        bool hit(const vec3& origin, const vec3& inv_dir, real tmin, real tmax) const {
+            for (int a = 0; a < 3; a++) {
+                real t0 = (_min[a] - origin[a]) * inv_dir[a];
+                real t1 = (_max[a] - origin[a]) * inv_dir[a];
+                if (inv_dir[a] < 0.0f) { real tmp = t0; t0 = t1; t1 = tmp; }
+                tmin = ffmax(t0, tmin);
+                tmax = ffmin(t1, tmax);
+                if (tmax < tmin)
+                    return false;
+            }
+            return true;
+        }
+
+        vec3 _min;
+        vec3 _max;
+};
+
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    vec3 small(ffmin(box0.min().x(), box1.min().x()),
+               ffmin(box0.min().y(), box1.min().y()),
+               ffmin(box0.min().z(), box1.min().z()));
+    vec3 big  (ffmax(box0.max().x(), box1.max().x()),
+               ffmax(box0.max().y(), box1.max().y()),
+               ffmax(box0.max().z(), box1.max().z()));
+    return aabb(small,big);
+}
+
+
+#endif
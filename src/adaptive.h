@@ -0,0 +1,151 @@
+#ifndef ADAPTIVEH
+#define ADAPTIVEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "render.h"
+
+
+// Adaptive sampling spends an average of render_settings::ns samples per pixel, but unevenly:
+// every pixel gets min_samples (at most ns), then passes of batch samples go only to pixels whose
+// luminance is still uncertain, until the budget runs out, every pixel converges, or a pixel
+// reaches max_samples. When the budget left is too small for a full pass it goes to the noisiest
+// pixels.
+struct adaptive_settings {
+    int min_samples = 8;
+    int max_samples = 256;
+    int batch = 8;
+    float threshold = 0.02f;    // target 95% confidence half-width, relative to the pixel's mean
+};
+
+
+// Running color sum plus Welford mean and M2 of the luminance.
+struct pixel_estimate {
+    vec3 sum = vec3(0,0,0);
+    int n = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(const vec3& c) {
+        sum += c;
+        n++;
+        double y = 0.2126*c.r() + 0.7152*c.g() + 0.0722*c.b();
+        double delta = y - mean;
+        mean += delta / n;
+        m2 += delta * (y - mean);
+    }
+
+    // Sample variance of the luminance divided by n, i.e. the variance of the mean.
+    double variance_of_mean() const { return n < 2 ? 0 : m2 / (n-1) / n; }
+
+    bool converged(float threshold) const {
+        if (n < 2) return false;
+        double half_width = 1.96 * sqrt(variance_of_mean());
+        // the floor keeps near-black pixels from demanding unbounded precision
+        return half_width <= threshold * (mean > 0.01 ? mean : 0.01);
+    }
+};
+
+
+// Fills fb with the estimate of each pixel and, if counts is non-null, with the samples it took.
+void render_adaptive(const camera& cam, hitable *world, const render_settings& settings,
+                     const adaptive_settings& adaptive, framebuffer& fb, std::vector<int> *counts) {
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, settings.tile_size);
+    std::vector<pixel_estimate> est(fb.pixels.size());
+    long long budget = (long long)settings.ns * fb.nx * fb.ny;
+    long long spent = 0;
+
+    // the first pass alone must not overspend the budget
+    int first = adaptive.min_samples < settings.ns ? adaptive.min_samples : settings.ns;
+    if (first < 1) first = 1;
+    int batch = adaptive.batch < 1 ? 1 : adaptive.batch;
+    // samples each pixel takes in the next pass, zero once it is done
+    std::vector<int> quota(fb.pixels.size(), first);
+    bool last = false;
+    for (;;) {
+        std::atomic<long long> taken(0);
+        std::atomic<long long> still_active(0);
+        parallel_for_work_stealing(int(tiles.size()), settings.threads, [&](int job, int) {
+            const tile& t = tiles[job];
+            RT_TIME_TILE(t);
+            long long tile_taken = 0, tile_active = 0;
+            path_stats stats;
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    int p = j*fb.nx + i;
+                    if (!quota[p]) continue;
+                    pixel_estimate& e = est[p];
+                    int before = e.n;
+                    int stop = e.n + quota[p];
+                    if (stop > adaptive.max_samples) stop = adaptive.max_samples;
+                    for (int s = e.n; s < stop; s++)
+                        e.add(trace_sample(cam, world, i, j, s, fb.nx, fb.ny, settings, stats));
+                    tile_taken += e.n - before;
+                    if (e.n >= adaptive.max_samples || e.converged(adaptive.threshold)) {
+                        quota[p] = 0;
+                    } else {
+                        quota[p] = batch;
+                        tile_active++;
+                    }
+                }
+            }
+            taken += tile_taken;
+            still_active += tile_active;
+        });
+        spent += taken;
+        if (last || still_active == 0 || spent >= budget)
+            break;
+        if (spent + still_active*batch > budget) {
+            // Not enough left for a full pass: the rest goes a batch at a time to the pixels
+            // whose means are least certain, and that pass is the last.
+            std::vector<int> order;
+            for (size_t p = 0; p < quota.size(); p++)
+                if (quota[p]) order.push_back(int(p));
+            std::sort(order.begin(), order.end(), [&](int a, int b) {
+                double va = est[a].variance_of_mean(), vb = est[b].variance_of_mean();
+                return va > vb || (va == vb && a < b);
+            });
+            long long left = budget - spent;
+            for (int p : order) {
+                long long give = std::min<long long>(left, std::min(batch, adaptive.max_samples - est[p].n));
+                quota[p] = int(give);
+                left -= give;
+            }
+            last = true;
+        }
+    }
+
+    for (size_t p = 0; p < est.size(); p++)
+        fb.pixels[p] = est[p].n ? est[p].sum / real(est[p].n) : vec3(0,0,0);
+    if (counts) {
+        counts->resize(est.size());
+        for (size_t p = 0; p < est.size(); p++)
+            (*counts)[p] = est[p].n;
+    }
+}
+
+
+// Sample counts as a gray image, white at max_samples, for checking where the budget went.
+framebuffer sample_count_image(const std::vector<int>& counts, int nx, int ny, int max_samples) {
+    framebuffer img(nx, ny);
+    for (size_t p = 0; p < counts.size(); p++) {
+        real g = real(counts[p]) / real(max_samples);
+        // squared so that write_image's gamma leaves the ramp linear
+        img.pixels[p] = vec3(g*g, g*g, g*g);
+    }
+    return img;
+}
+
+
+#endif
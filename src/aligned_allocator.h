@@ -0,0 +1,46 @@
+#ifndef ALIGNEDALLOCATORH
+#define ALIGNEDALLOCATORH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+
+// Allocator for std::vector whose storage starts on an Align-byte boundary, so SIMD kernels can
+// use aligned loads on the first element.
+template <typename T, std::size_t Align = 32>
+struct aligned_allocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef aligned_allocator<U, Align> other; };
+
+    aligned_allocator() {}
+    template <typename U> aligned_allocator(const aligned_allocator<U, Align>&) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T *p, std::size_t) {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+};
+
+template <typename T, typename U, std::size_t Align>
+bool operator==(const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&) { return true; }
+template <typename T, typename U, std::size_t Align>
+bool operator!=(const aligned_allocator<T, Align>&, const aligned_allocator<U, Align>&) { return false; }
+
+template <typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T> >;
+
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef ARENAH
+#define ARENAH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Bump allocator for scene data. Objects of one scene sit next to each other in large blocks with
+// no per-object headers, and all of them are released at once when the arena is destroyed. Types
+// with a nontrivial destructor, such as the hitables with their virtual one, cost one entry per
+// create() or create_array() call, and are destroyed in reverse order of creation first.
+class arena {
+    public:
+        explicit arena(size_t block_size = 1 << 20) : block_bytes(block_size), cur(0), end(0), used(0) {}
+        ~arena() {
+            for (size_t k = cleanups.size(); k-- > 0; )
+                cleanups[k].destroy(cleanups[k].objects, cleanups[k].count);
+            for (char *b : blocks)
+                free(b);
+        }
+
+        void *allocate(size_t size, size_t align) {
+            uintptr_t p = (uintptr_t(cur) + align - 1) & ~uintptr_t(align - 1);
+            if (!cur || p + size > uintptr_t(end)) {
+                size_t want = size + align > block_bytes ? size + align : block_bytes;
+                char *b = static_cast<char*>(malloc(want));
+                if (!b) throw std::bad_alloc();
+                blocks.push_back(b);
+                cur = b;
+                end = b + want;
+                p = (uintptr_t(cur) + align - 1) & ~uintptr_t(align - 1);
+            }
+            cur = reinterpret_cast<char*>(p + size);
+            used += size;
+            return reinterpret_cast<void*>(p);
+        }
+
+        template <typename T, typename... Args>
+        T *create(Args&&... args) {
+            T *p = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            remember<T>(p, 1);
+            return p;
+        }
+
+        template <typename T>
+        T *create_array(size_t n) {
+            T *a = static_cast<T*>(allocate(n*sizeof(T), alignof(T)));
+            for (size_t i = 0; i < n; i++)
+                new (a + i) T();
+            remember<T>(a, n);
+            return a;
+        }
+
+        size_t bytes_used() const { return used; }
+
+    private:
+        arena(const arena&);
+        arena& operator=(const arena&);
+
+        struct cleanup {
+            void (*destroy)(void *objects, size_t count);
+            void *objects;
+            size_t count;
+        };
+
+        template <typename T>
+        void remember(T *objects, size_t count) {
+            if (std::is_trivially_destructible<T>::value) return;
+            cleanup c = { [](void *p, size_t n) {
+                for (size_t i = n; i-- > 0; )
+                    static_cast<T*>(p)[i].~T();
+            }, objects, count };
+            cleanups.push_back(c);
+        }
+
+        size_t block_bytes;
+        char *cur, *end;
+        size_t used;
+        std::vector<char*> blocks;
+        std::vector<cleanup> cleanups;
+};
+
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef BATCHH
+#define BATCHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "camera.h"
+#include "framebuffer.h"
+#include "scene.h"
+
+
+// A camera pinned to a point in time on a path.
+struct camera_key {
+    real time;
+    scene_camera cam;
+};
+
+
+// Keyframes in increasing time. Eye and target follow a Catmull-Rom spline through the keys so
+// the motion has no kinks at them; up vector, field of view and lens settings are interpolated
+// linearly. Times outside the keys clamp to the first or last one.
+class camera_path {
+    public:
+        void add(real time, const scene_camera& cam) {
+            camera_key k = { time, cam };
+            size_t i = keys.size();
+            while (i > 0 && keys[i-1].time > time) i--;
+            keys.insert(keys.begin() + i, k);
+        }
+        bool empty() const { return keys.empty(); }
+        real start() const { return keys.front().time; }
+        real end() const { return keys.back().time; }
+
+        scene_camera at(real time) const {
+            if (time <= keys.front().time) return keys.front().cam;
+            if (time >= keys.back().time) return keys.back().cam;
+            size_t i = 1;
+            while (keys[i].time < time) i++;
+            const scene_camera& p1 = keys[i-1].cam;
+            const scene_camera& p2 = keys[i].cam;
+            const scene_camera& p0 = i >= 2 ? keys[i-2].cam : p1;
+            const scene_camera& p3 = i+1 < keys.size() ? keys[i+1].cam : p2;
+            real t = (time - keys[i-1].time) / (keys[i].time - keys[i-1].time);
+            scene_camera c;
+            for (int a = 0; a < 3; a++) {
+                c.lookfrom[a] = spline(p0.lookfrom[a], p1.lookfrom[a], p2.lookfrom[a], p3.lookfrom[a], t);
+                c.lookat[a] = spline(p0.lookat[a], p1.lookat[a], p2.lookat[a], p3.lookat[a], t);
+                c.vup[a] = lerp(p1.vup[a], p2.vup[a], t);
+            }
+            c.vfov = lerp(p1.vfov, p2.vfov, t);
+            c.aperture = lerp(p1.aperture, p2.aperture, t);
+            c.focus_dist = lerp(p1.focus_dist, p2.focus_dist, t);
+            return c;
+        }
+
+        std::vector<camera_key> keys;
+
+    private:
+        static float lerp(float a, float b, real t) { return float(a + (b - a)*t); }
+        static float spline(float p0, float p1, float p2, float p3, real t) {
+            real t2 = t*t, t3 = t2*t;
+            return float(0.5*(2*p1 + (p2 - p0)*t + (2*p0 - 5*p1 + 4*p2 - p3)*t2 + (3*p1 - p0 - 3*p2 + p3)*t3));
+        }
+};
+
+
+// Evenly spaced samples of the path from its first key to its last, both included.
+std::vector<scene_camera> sample_path(const camera_path& path, int frames) {
+    std::vector<scene_camera> cams;
+    for (int k = 0; k < frames; k++) {
+        real t = frames > 1 ? real(k) / real(frames - 1) : 0;
+        cams.push_back(path.at(path.start() + t*(path.end() - path.start())));
+    }
+    return cams;
+}
+
+
+// One full orbit of the eye around the target, about the up vector, in the given number of
+// frames; frame 0 is the camera itself and the last frame stops one step short of it.
+std::vector<scene_camera> turntable(const scene_camera& c, int frames) {
+    vec3 target(c.lookat[0], c.lookat[1], c.lookat[2]);
+    vec3 axis = unit_vector(vec3(c.vup[0], c.vup[1], c.vup[2]));
+    vec3 arm = vec3(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]) - target;
+    std::vector<scene_camera> cams;
+    for (int k = 0; k < frames; k++) {
+        real angle = 2*M_PI*k / frames;
+        real ca = cos(angle), sa = sin(angle);
+        // Rodrigues' rotation of the arm about the axis
+        vec3 p = target + ca*arm + sa*cross(axis, arm) + (1 - ca)*dot(axis, arm)*axis;
+        scene_camera f = c;
+        f.lookfrom[0] = float(p.x());
+        f.lookfrom[1] = float(p.y());
+        f.lookfrom[2] = float(p.z());
+        cams.push_back(f);
+    }
+    return cams;
+}
+
+
+// Camera path files use the scene format's camera record, one per line, '#' starts a comment:
+//     camera <lookfrom x y z> <lookat x y z> <vup x y z> <vfov> <aperture> <focus_dist>
+//     key <time> <lookfrom x y z> <lookat x y z> <vup x y z> <vfov> <aperture> <focus_dist>
+// A plain camera record is a key at time equal to its line's index among the records.
+bool read_camera_path(const char *path, camera_path& out, std::string& error) {
+    std::ifstream in(path);
+    if (!in) { error = "cannot open " + std::string(path); return false; }
+    std::string line;
+    int line_no = 0;
+    int records = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        real time = real(records);
+        scene_camera c;
+        bool ok = (kind == "camera" || (kind == "key" && ls >> time))
+                  && ls >> c.lookfrom[0] >> c.lookfrom[1] >> c.lookfrom[2]
+                        >> c.lookat[0] >> c.lookat[1] >> c.lookat[2]
+                        >> c.vup[0] >> c.vup[1] >> c.vup[2]
+                        >> c.vfov >> c.aperture >> c.focus_dist;
+        if (!ok) {
+            error = std::string(path) + ":" + std::to_string(line_no) + ": bad " + kind + " record";
+            return false;
+        }
+        out.add(time, c);
+        records++;
+    }
+    if (out.empty()) { error = std::string(path) + ": no cameras"; return false; }
+    return true;
+}
+
+
+// Expands a printf-style frame number ("%d", "%04d") in pattern. A pattern without one gets
+// "-NNNN" inserted before its extension, so frames never overwrite each other.
+std::string frame_path(const std::string& pattern, int frame) {
+    size_t pct = pattern.find('%');
+    if (pct != std::string::npos) {
+        size_t d = pct + 1;
+        while (d < pattern.size() && pattern[d] >= '0' && pattern[d] <= '9') d++;
+        if (d < pattern.size() && pattern[d] == 'd') {
+            char number[32];
+            snprintf(number, sizeof(number), ("%" + pattern.substr(pct + 1, d - pct)).c_str(), frame);
+            return pattern.substr(0, pct) + number + pattern.substr(d + 1);
+        }
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "-%04d", frame);
+    size_t dot = pattern.rfind('.');
+    size_t slash = pattern.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = pattern.size();
+    return pattern.substr(0, dot) + number + pattern.substr(dot);
+}
+
+
+struct batch_stats {
+    int frames = 0;
+    double render_seconds = 0;  // inside render_frame
+    double wall_seconds = 0;    // the whole batch, including the last frame's write
+};
+
+
+// Renders one frame per camera with render_frame(cam, k, fb) and hands each finished frame to
+// write_frame(k, fb) on a writer thread, so frame k is quantized and written while frame k+1
+// traces. The scene and acceleration structure are whatever render_frame captured, built once by
+// the caller. Two framebuffers alternate between the renderer and the writer; the renderer only
+// waits when the writer is a full frame behind. Stops at the first failed write and returns false.
+template <typename Render, typename Write>
+bool render_batch(const std::vector<camera>& cams, int nx, int ny, Render render_frame, Write write_frame,
+                  batch_stats *stats = 0) {
+    const int depth = 2;
+    const int frames = int(cams.size());
+    std::vector<framebuffer> buffers(depth, framebuffer(nx, ny));
+    std::mutex m;
+    std::condition_variable cv;
+    int rendered = 0;   // frames [0, rendered) are finished and may be written
+    int written = 0;    // frames [0, written) are written and their buffers free
+    bool failed = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread writer([&] {
+        for (int k = 0; k < frames; k++) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return rendered > k; });
+            }
+            bool ok = write_frame(k, (const framebuffer&)buffers[k % depth]);
+            std::lock_guard<std::mutex> lock(m);
+            written = k + 1;
+            if (!ok) failed = true;
+            cv.notify_all();
+            if (!ok) return;
+        }
+    });
+
+    double render_seconds = 0;
+    for (int k = 0; k < frames; k++) {
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&] { return failed || written > k - depth; });
+            if (failed) break;
+        }
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        render_frame(cams[k], k, buffers[k % depth]);
+        render_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::lock_guard<std::mutex> lock(m);
+        rendered = k + 1;
+        cv.notify_all();
+    }
+    {
+        // releases a writer still waiting for frames that will never come
+        std::lock_guard<std::mutex> lock(m);
+        if (failed) rendered = frames;
+    }
+    cv.notify_all();
+    writer.join();
+
+    if (stats) {
+        stats->frames = failed ? written - 1 : written;
+        stats->render_seconds = render_seconds;
+        stats->wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return !failed;
+}
+
+
+#endif
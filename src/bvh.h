@@ -0,0 +1,267 @@
+#ifndef BVHH
+#define BVHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <algorithm>
+#include <vector>
+#include "hitable.h"
+
+
+// Nodes live in one array in depth-first order: an interior node's first child directly follows
+// it, and offset holds the index of its second child. For a leaf, offset is the first entry of
+// its primitive range in bvh_tree::order.
+struct bvh_node {
+    aabb box;
+    int offset;
+    unsigned short count;   // primitives in a leaf, 0 for interior nodes
+    unsigned short axis;    // split axis, used to visit the nearer child first
+};
+
+
+// Binned-SAH hierarchy over a set of boxes. It only knows primitive indices, so any primitive
+// storage can sit behind it by supplying a leaf intersector to traverse().
+class bvh_tree {
+    public:
+        static const int num_bins = 12;
+        static const int median_split_depth = 64;
+        static const int max_stack = 128;
+
+        void build(const std::vector<aabb>& boxes, int max_leaf_size);
+
+        // Visits leaves front to back, calling leaf(first, count, closest) for each leaf whose box
+        // is hit closer than closest. leaf returns true when it found a hit and lowered closest.
+        template <typename Leaf>
+        bool traverse(const ray& r, real t_min, real t_max, Leaf leaf) const;
+
+        // Recomputes every box bottom up, taking each leaf's from leaf_box(offset, count), for
+        // primitives that moved or were stored differently than the boxes the tree was built from.
+        template <typename LeafBox>
+        void refit(LeafBox leaf_box);
+
+        std::vector<bvh_node> nodes;
+        std::vector<int> order;
+
+    private:
+        int build_range(const std::vector<aabb>& boxes, const std::vector<vec3>& centroids,
+                        int begin, int end, int depth, int max_leaf_size);
+};
+
+
+void bvh_tree::build(const std::vector<aabb>& boxes, int max_leaf_size) {
+    int n = int(boxes.size());
+    nodes.clear();
+    order.resize(n);
+    if (n == 0) return;
+    if (max_leaf_size < 1) max_leaf_size = 1;
+    std::vector<vec3> centroids(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+        centroids[i] = boxes[i].centroid();
+    }
+    nodes.reserve(2*n);
+    build_range(boxes, centroids, 0, n, 0, max_leaf_size);
+}
+
+
+int bvh_tree::build_range(const std::vector<aabb>& boxes, const std::vector<vec3>& centroids,
+                          int begin, int end, int depth, int max_leaf_size) {
+    int index = int(nodes.size());
+    nodes.push_back(bvh_node());
+    int count = end - begin;
+
+    aabb box = boxes[order[begin]];
+    aabb cbox(centroids[order[begin]], centroids[order[begin]]);
+    for (int i = begin+1; i < end; i++) {
+        box = surrounding_box(box, boxes[order[i]]);
+        cbox = surrounding_box(cbox, aabb(centroids[order[i]], centroids[order[i]]));
+    }
+    nodes[index].box = box;
+
+    vec3 extent = cbox.max() - cbox.min();
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+
+    if (count <= max_leaf_size || extent[axis] <= 0.0f) {
+        if (count <= 65535) {
+            nodes[index].offset = begin;
+            nodes[index].count = (unsigned short)count;
+            nodes[index].axis = 0;
+            return index;
+        }
+    }
+
+    int mid = begin;
+    if (depth < median_split_depth && extent[axis] > 0.0f) {
+        // Binned SAH: bucket centroids along each axis and sweep for the cheapest plane.
+        real best_cost = real(count);
+        int best_axis = -1, best_split = 0;
+        for (int a = 0; a < 3; a++) {
+            if (extent[a] <= 0.0f) continue;
+            int bin_count[num_bins] = {0};
+            aabb bin_box[num_bins];
+            real scale = num_bins / extent[a];
+            for (int i = begin; i < end; i++) {
+                int b = int((centroids[order[i]][a] - cbox.min()[a]) * scale);
+                if (b >= num_bins) b = num_bins-1;
+                bin_box[b] = bin_count[b] ? surrounding_box(bin_box[b], boxes[order[i]]) : boxes[order[i]];
+                bin_count[b]++;
+            }
+            real right_area[num_bins];
+            int right_count[num_bins];
+            aabb acc;
+            int n = 0;
+            for (int b = num_bins-1; b > 0; b--) {
+                if (bin_count[b]) { acc = n ? surrounding_box(acc, bin_box[b]) : bin_box[b]; n += bin_count[b]; }
+                right_area[b] = n ? acc.surface_area() : 0;
+                right_count[b] = n;
+            }
+            n = 0;
+            for (int b = 1; b < num_bins; b++) {
+                if (bin_count[b-1]) { acc = n ? surrounding_box(acc, bin_box[b-1]) : bin_box[b-1]; n += bin_count[b-1]; }
+                if (n == 0 || right_count[b] == 0) continue;
+                real cost = 1.0f + (n*acc.surface_area() + right_count[b]*right_area[b]) / box.surface_area();
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_split = b;
+                }
+            }
+        }
+        if (best_axis >= 0) {
+            axis = best_axis;
+            real lo = cbox.min()[axis];
+            real scale = num_bins / extent[axis];
+            int *split = std::partition(&order[begin], &order[0] + end, [&](int p) {
+                int b = int((centroids[p][axis] - lo) * scale);
+                if (b >= num_bins) b = num_bins-1;
+                return b < best_split;
+            });
+            mid = int(split - &order[0]);
+        }
+    }
+    if (mid <= begin || mid >= end) {
+        // Degenerate or too deep: an even split keeps the remaining depth logarithmic.
+        mid = begin + count/2;
+        std::nth_element(&order[begin], &order[mid], &order[0] + end, [&](int p, int q) {
+            return centroids[p][axis] < centroids[q][axis];
+        });
+    }
+
+    build_range(boxes, centroids, begin, mid, depth+1, max_leaf_size);
+    int second = build_range(boxes, centroids, mid, end, depth+1, max_leaf_size);
+    nodes[index].offset = second;
+    nodes[index].count = 0;
+    nodes[index].axis = (unsigned short)axis;
+    return index;
+}
+
+
+template <typename Leaf>
+bool bvh_tree::traverse(const ray& r, real t_min, real t_max, Leaf leaf) const {
+    if (nodes.empty()) return false;
+    vec3 origin = r.origin();
+    vec3 dir = r.direction();
+    vec3 inv_dir(1.0f/dir.x(), 1.0f/dir.y(), 1.0f/dir.z());
+    real closest_so_far = t_max;
+    bool hit_anything = false;
+    int stack[max_stack];
+    int sp = 0;
+    int node = 0;
+    for (;;) {
+        const bvh_node& n = nodes[node];
+        if (n.box.hit(origin, inv_dir, t_min, closest_so_far)) {
+            if (n.count > 0) {
+                if (leaf(n.offset, int(n.count), closest_so_far))
+                    hit_anything = true;
+            }
+            else if (dir[n.axis] < 0) {
+                stack[sp++] = node+1;
+                node = n.offset;
+                continue;
+            }
+            else {
+                stack[sp++] = n.offset;
+                node = node+1;
+                continue;
+            }
+        }
+        if (sp == 0) break;
+        node = stack[--sp];
+    }
+    return hit_anything;
+}
+
+
+template <typename LeafBox>
+void bvh_tree::refit(LeafBox leaf_box) {
+    // depth-first order puts both children after their parent
+    for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+        bvh_node& n = nodes[i];
+        if (n.count > 0)
+            n.box = leaf_box(n.offset, int(n.count));
+        else
+            n.box = surrounding_box(nodes[i+1].box, nodes[n.offset].box);
+    }
+}
+
+
+// A hitable that replaces the linear scan of hitable_list with a BVH over its objects.
+class bvh : public hitable {
+    public:
+        bvh() {}
+        bvh(hitable **l, int n, int max_leaf_size = 2);
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        bvh_tree tree;
+        std::vector<hitable*> prims;    // in leaf order, so each leaf is a contiguous range
+};
+
+
+bvh::bvh(hitable **l, int n, int max_leaf_size) {
+    std::vector<aabb> boxes(n);
+    for (int i = 0; i < n; i++) {
+        if (!l[i]->bounding_box(boxes[i]))
+            std::cerr << "no bounding box in bvh constructor\n";
+    }
+    tree.build(boxes, max_leaf_size);
+    prims.resize(n);
+    for (int i = 0; i < n; i++)
+        prims[i] = l[tree.order[i]];
+}
+
+
+bool bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    return tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest_so_far) {
+        hit_record temp_rec;
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            if (prims[i]->hit(r, t_min, closest_so_far, temp_rec)) {
+                hit_anything = true;
+                closest_so_far = temp_rec.t;
+                rec = temp_rec;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+
+bool bvh::bounding_box(aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.nodes[0].box;
+    return true;
+}
+
+
+#endif
@@ -13,10 +13,20 @@
 
 #include "ray.h"
 #include "random.h"
+#include "sampler.h"
+#include "instrument.h"
 
+// With a sampler the lens point is mapped from its next two dimensions in fixed time; otherwise
+// it is rejection sampled from thread_rng() as it always was.
 vec3 random_in_unit_disk() {
+    if (sampling_enabled()) {
+        double u[2];
+        sample_2d(u);
+        return concentric_disk(u[0], u[1]);
+    }
     vec3 p;
     do {
+        RT_COUNT(disk_rejection_iterations);
         p = 2.0*vec3(random_double(),random_double(),0) - vec3(1,1,0);
     } while (dot(p,p) >= 1.0);
     return p;
@@ -24,12 +34,12 @@ vec3 random_in_unit_disk() {
 
 class camera {
     public:
-        camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float aperture, float focus_dist) {
+        camera(vec3 lookfrom, vec3 lookat, vec3 vup, real vfov, real aspect, real aperture, real focus_dist) {
             // vfov is top to bottom in degrees
             lens_radius = aperture / 2;
-            float theta = vfov*M_PI/180;
-            float half_height = tan(theta/2);
-            float half_width = aspect * half_height;
+            real theta = vfov*M_PI/180;
+            real half_height = tan(theta/2);
+            real half_width = aspect * half_height;
             origin = lookfrom;
             w = unit_vector(lookfrom - lookat);
             u = unit_vector(cross(vup, w));
@@ -38,7 +48,7 @@ class camera {
             horizontal = 2*half_width*focus_dist*u;
             vertical = 2*half_height*focus_dist*v;
         }
-        ray get_ray(float s, float t) {
+        ray get_ray(real s, real t) const {
             vec3 rd = lens_radius*random_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
             return ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset);
@@ -49,7 +59,7 @@ class camera {
         vec3 horizontal;
         vec3 vertical;
         vec3 u, v, w;
-        float lens_radius;
+        real lens_radius;
 };
 
 
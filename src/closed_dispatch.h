@@ -0,0 +1,120 @@
+#ifndef CLOSEDDISPATCHH
+#define CLOSEDDISPATCHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include "render.h"
+#include "scene.h"
+#include "sphere_set.h"
+
+
+// Closed-set alternative to the virtual hitable/material hierarchy. Materials are stored by value
+// in a variant table and dispatched with std::visit; the world is a concrete type whose hit()
+// the compiler sees. The hierarchy is untouched, so new types still plug in through the virtual
+// interface and color(). It measures no faster than color() on sphere scenes (rtbench
+// integrator_*): the one virtual hit() per ray leads into the same SIMD leaf loops, and
+// std::visit's jump table costs about what the vtable did.
+
+typedef std::variant<lambertian, metal, dielectric> material_variant;
+
+
+std::vector<material_variant> make_material_variants(const scene_description& scene) {
+    std::vector<material_variant> mats;
+    mats.reserve(scene.num_materials);
+    for (size_t i = 0; i < scene.num_materials; i++) {
+        const scene_material& m = scene.materials[i];
+        vec3 albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        if (m.type == scene_lambertian) mats.push_back(lambertian(albedo));
+        else if (m.type == scene_metal) mats.push_back(metal(albedo, m.param));
+        else mats.push_back(dielectric(m.param));
+    }
+    return mats;
+}
+
+
+inline bool scatter_variant(const material_variant& m, const ray& r_in, const hit_record& rec,
+                            vec3& attenuation, ray& scattered) {
+    return std::visit([&](const auto& mat) {
+        typedef typename std::decay<decltype(mat)>::type M;
+        return mat.M::scatter(r_in, rec, attenuation, scattered);
+    }, m);
+}
+
+
+// The instrumentation counters' kind for a variant, matching material::kind() for the same type.
+inline material_kind variant_kind(const material_variant& m) {
+    return std::visit([](const auto& mat) {
+        typedef typename std::decay<decltype(mat)>::type M;
+        return mat.M::kind();
+    }, m);
+}
+
+
+// Primitive tables with a world_hit() specialization get a fully inlined hit test.
+template <typename World>
+inline bool world_hit(const World& world, const ray& r, real t_min, real t_max, hit_record& rec, int& material);
+
+template <>
+inline bool world_hit<sphere_set>(const sphere_set& world, const ray& r, real t_min, real t_max,
+                                  hit_record& rec, int& material) {
+    return world.hit_indexed(r, t_min, t_max, rec, material);
+}
+
+
+// color() with both dispatches resolved at compile time; same arithmetic and the same
+// path_policy tests, so the same image.
+template <typename World>
+vec3 color_closed(const ray& r, const World& world, const std::vector<material_variant>& mats, int depth,
+                  const path_policy& policy, const vec3& throughput, path_stats& stats) {
+    hit_record rec;
+    int material;
+    stats.rays++;
+    if (depth == 0) RT_COUNT(primary_rays); else RT_COUNT(secondary_rays);
+    if (world_hit(world, r, 0.001, MAXFLOAT, rec, material)) {
+        ray scattered;
+        vec3 attenuation;
+        RT_COUNT(material_hits[variant_kind(mats[material])]);
+        if (depth < policy.max_depth && scatter_variant(mats[material], r, rec, attenuation, scattered)) {
+            vec3 next = throughput*attenuation;
+            real q = survival_probability(policy, depth+1, next);
+            if (q < 1) {
+                if (random_double() >= q) {
+                    RT_COUNT_DEPTH(depth+1);
+                    return vec3(0,0,0);
+                }
+                return attenuation*color_closed(scattered, world, mats, depth+1, policy, next/q, stats) / q;
+            }
+            return attenuation*color_closed(scattered, world, mats, depth+1, policy, next, stats);
+        }
+        else {
+            RT_COUNT_DEPTH(depth+1);
+            return vec3(0,0,0);
+        }
+    }
+    else {
+        RT_COUNT_DEPTH(depth+1);
+        return sky_color(r);
+    }
+}
+
+
+template <typename World>
+path_stats render_closed(const camera& cam, const World& world, const std::vector<material_variant>& mats,
+                         const render_settings& settings, framebuffer& fb) {
+    return render_tiles(cam, settings, fb, [&](const ray& r, path_stats& stats) {
+        return color_closed(r, world, mats, 0, settings.paths, vec3(1,1,1), stats);
+    });
+}
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef COMPACTSCENEH
+#define COMPACTSCENEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "bvh.h"
+#include "hitable.h"
+#include "instrument.h"
+#include "material.h"
+#include "scene.h"
+
+
+// A material palette entry's identity: the type and the bits of the values that type uses, so
+// only materials that scatter identically share an entry.
+struct palette_key {
+    int32_t type;
+    uint32_t albedo[3], param;
+    bool operator==(const palette_key& o) const {
+        return type == o.type && albedo[0] == o.albedo[0] && albedo[1] == o.albedo[1]
+            && albedo[2] == o.albedo[2] && param == o.param;
+    }
+};
+
+struct palette_key_hash {
+    size_t operator()(const palette_key& k) const {
+        uint64_t h = uint64_t(k.type);
+        h = h*0x9e3779b97f4a7c15ULL + k.albedo[0];
+        h = h*0x9e3779b97f4a7c15ULL + k.albedo[1];
+        h = h*0x9e3779b97f4a7c15ULL + k.albedo[2];
+        h = h*0x9e3779b97f4a7c15ULL + k.param;
+        return size_t(h ^ (h >> 29));
+    }
+};
+
+
+palette_key make_palette_key(const scene_material& m) {
+    palette_key k;
+    memset(&k, 0, sizeof(k));
+    k.type = m.type;
+    if (m.type != scene_dielectric) memcpy(k.albedo, m.albedo, sizeof(k.albedo));
+    if (m.type != scene_lambertian) memcpy(&k.param, &m.param, sizeof(k.param));
+    return k;
+}
+
+
+// Deduplicates the scene's materials into shared ones, one arena allocation each, and fills
+// index_of with every scene material's palette index.
+std::vector<material*> make_material_palette(const scene_description& scene, arena& mem,
+                                             std::vector<int32_t>& index_of) {
+    std::vector<size_t> first_of;
+    std::unordered_map<palette_key, int32_t, palette_key_hash> ids;
+    index_of.assign(scene.num_materials, 0);
+    for (size_t i = 0; i < scene.num_materials; i++) {
+        auto found = ids.emplace(make_palette_key(scene.materials[i]), int32_t(first_of.size()));
+        if (found.second) first_of.push_back(i);
+        index_of[i] = found.first->second;
+    }
+
+    std::vector<material*> palette(first_of.size());
+    for (size_t e = 0; e < first_of.size(); e++) {
+        const scene_material& m = scene.materials[first_of[e]];
+        vec3 albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        if (m.type == scene_lambertian) palette[e] = mem.create<lambertian>(albedo);
+        else if (m.type == scene_metal) palette[e] = mem.create<metal>(albedo, m.param);
+        else palette[e] = mem.create<dielectric>(m.param);
+    }
+    return palette;
+}
+
+
+// 16-bit center coordinates on the grid of the sphere's leaf, and a 16-bit radius in steps of
+// the leaf's radius_step, rounded so the decoded sphere encloses the scene's.
+struct quantized_sphere {
+    uint16_t center[3];
+    uint16_t radius;
+};
+
+
+// Where a leaf's spheres are and how to decode them.
+struct compact_leaf {
+    float origin[3];    // smallest center coordinate on each axis
+    float step[3];      // center units per quantum
+    float radius_step;
+    int32_t first;      // into quantized and sphere_id
+};
+
+
+// Spheres at 12 bytes each, 8 quantized and 4 to find the exact record, about 29 with their share
+// of leaves and BVH nodes, against about 31 for sphere_set before materials. The palette adds a
+// pointer per distinct material and an index per scene material: another 12 bytes per sphere for
+// random_scene(), whose materials are nearly all distinct, and next to nothing for scenes that
+// share a few. The exact spheres stay in the scene's own table, which must outlive the set; for
+// a binary scene that is the mapped file.
+// Centers and radii are quantized relative to their BVH leaf into spheres that enclose the exact
+// ones, and the node boxes are refit over those, so they only cull. A sphere that the ray comes
+// near is refined against its exact record with sphere_set's arithmetic, and the tree has
+// sphere_set's shape and visiting order, so hits, and images, match -a spheres exactly.
+class compact_sphere_set : public hitable {
+    public:
+        static const int leaf_size = 8;
+
+        compact_sphere_set() {}
+        void build(const scene_description& scene, arena& mem);
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        // Tests a leaf's spheres and returns the position of the nearest hit in (t_min, closest)
+        // within the leaf, lowering closest to it, or -1 if there is none.
+        int hit_leaf(const ray& r, int leaf, int count, real t_min, real& closest) const;
+        // Whether r can hit the exact sphere at position k of leaf within (t_min, closest).
+        // Errs towards true: the roots are widened by more than the rounding error of either test.
+        bool may_hit(const ray& r, int leaf, int k, real t_min, real closest) const;
+        void decode(int leaf, int k, vec3& center, real& radius) const;
+        const scene_sphere& exact(int leaf, int k) const { return spheres[sphere_id[leaves[leaf].first + k]]; }
+
+        int size() const { return num_spheres; }
+        // Bytes the set holds beside the scene's sphere table.
+        size_t bytes() const {
+            return quantized.size()*sizeof(quantized_sphere) + sphere_id.size()*sizeof(uint32_t)
+                 + leaves.size()*sizeof(compact_leaf) + tree.nodes.size()*sizeof(bvh_node)
+                 + palette.size()*sizeof(material*) + palette_of.size()*sizeof(int32_t);
+        }
+
+        int num_spheres = 0;
+        const scene_sphere *spheres = 0;
+        std::vector<quantized_sphere> quantized;    // in leaf order
+        std::vector<uint32_t> sphere_id;            // each quantized sphere's index in spheres
+        std::vector<compact_leaf> leaves;
+        std::vector<material*> palette;
+        std::vector<int32_t> palette_of;            // by scene material
+        bvh_tree tree;      // a leaf's offset is its index in leaves
+};
+
+
+inline void compact_sphere_set::decode(int leaf, int k, vec3& center, real& radius) const {
+    const compact_leaf& l = leaves[leaf];
+    const quantized_sphere& s = quantized[l.first + k];
+    center = vec3(l.origin[0] + float(s.center[0])*l.step[0],
+                  l.origin[1] + float(s.center[1])*l.step[1],
+                  l.origin[2] + float(s.center[2])*l.step[2]);
+    radius = float(s.radius)*l.radius_step;
+}
+
+
+void compact_sphere_set::build(const scene_description& scene, arena& mem) {
+    palette = make_material_palette(scene, mem, palette_of);
+    spheres = scene.spheres;
+    num_spheres = int(scene.num_spheres);
+    // the boxes sphere_set::build() makes, so the tree has the same shape
+    std::vector<aabb> boxes(num_spheres);
+    for (int i = 0; i < num_spheres; i++) {
+        const scene_sphere& s = scene.spheres[i];
+        vec3 c(s.center[0], s.center[1], s.center[2]);
+        vec3 rr(s.radius, s.radius, s.radius);
+        boxes[i] = aabb(c - rr, c + rr);
+    }
+    tree.build(boxes, leaf_size);
+    std::vector<aabb>().swap(boxes);
+    quantized.reserve(num_spheres);
+    sphere_id.reserve(num_spheres);
+
+    for (bvh_node& n : tree.nodes) {
+        if (n.count == 0) continue;
+        const int *ids = &tree.order[n.offset];
+        compact_leaf l;
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++) lo[a] = hi[a] = scene.spheres[ids[0]].center[a];
+        for (int k = 0; k < n.count; k++) {
+            const scene_sphere& s = scene.spheres[ids[k]];
+            for (int a = 0; a < 3; a++) {
+                lo[a] = s.center[a] < lo[a] ? s.center[a] : lo[a];
+                hi[a] = s.center[a] > hi[a] ? s.center[a] : hi[a];
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            l.origin[a] = lo[a];
+            l.step[a] = (hi[a] - lo[a]) / 65535.0f;
+        }
+        l.first = int32_t(quantized.size());
+
+        // Each sphere must grow by how far its decoded center moved; measured on the decoded
+        // values, exactly as hit() will see them.
+        std::vector<quantized_sphere> q(n.count);
+        std::vector<double> reach(n.count);
+        double reach_max = 0;
+        for (int k = 0; k < n.count; k++) {
+            const scene_sphere& s = scene.spheres[ids[k]];
+            double moved = 0;
+            for (int a = 0; a < 3; a++) {
+                real v = l.step[a] > 0 ? floor((s.center[a] - l.origin[a]) / l.step[a] + 0.5f) : 0;
+                q[k].center[a] = uint16_t(v < 0 ? 0 : v > 65535 ? 65535 : v);
+                double d = double(l.origin[a] + float(q[k].center[a])*l.step[a]) - s.center[a];
+                moved += d*d;
+            }
+            reach[k] = s.radius + sqrt(moved);
+            reach_max = reach[k] > reach_max ? reach[k] : reach_max;
+        }
+        // one spare step so the largest still rounds up inside 16 bits
+        l.radius_step = ffmax(float(reach_max / 65534), FLT_MIN);
+        for (int k = 0; k < n.count; k++) {
+            double v = ceil(reach[k] / l.radius_step) + 1;
+            q[k].radius = uint16_t(v > 65535 ? 65535 : v);
+            quantized.push_back(q[k]);
+            sphere_id.push_back(uint32_t(ids[k]));
+        }
+        n.offset = int(leaves.size());
+        leaves.push_back(l);
+    }
+    std::vector<int>().swap(tree.order);
+    quantized.shrink_to_fit();
+    sphere_id.shrink_to_fit();
+
+    tree.refit([&](int leaf, int count) {
+        aabb box;
+        for (int k = 0; k < count; k++) {
+            vec3 c;
+            real r;
+            decode(leaf, k, c, r);
+            aabb b(c - vec3(r, r, r), c + vec3(r, r, r));
+            box = k ? surrounding_box(box, b) : b;
+        }
+        return box;
+    });
+}
+
+
+inline bool compact_sphere_set::may_hit(const ray& r, int leaf, int k, real t_min, real closest) const {
+    vec3 center;
+    real radius;
+    decode(leaf, k, center, radius);
+    vec3 oc = r.origin() - center;
+    real a = dot(r.direction(), r.direction());
+    real b = dot(oc, r.direction());
+    real oc2 = dot(oc, oc);
+    real discriminant = b*b - a*(oc2 - radius*radius);
+    real slack = 16*std::numeric_limits<real>::epsilon()*(b*b + a*(oc2 + radius*radius));
+    if (discriminant + slack <= 0) return false;
+    real sq = sqrt(ffmax(discriminant, real(0)) + slack);
+    return -b + sq > a*t_min && -b - sq < a*closest;
+}
+
+
+int compact_sphere_set::hit_leaf(const ray& r, int leaf, int count, real t_min, real& closest) const {
+    RT_COUNT_N(primitive_tests, count);
+    int best = -1;
+    for (int k = 0; k < count; k++) {
+        if (!may_hit(r, leaf, k, t_min, closest)) continue;
+        // sphere_set::hit_range_scalar() on the exact sphere
+        const scene_sphere& s = exact(leaf, k);
+        vec3 oc = r.origin() - vec3(s.center[0], s.center[1], s.center[2]);
+        real radius = s.radius;
+        real a = dot(r.direction(), r.direction());
+        real b = dot(oc, r.direction());
+        real c = dot(oc, oc) - radius*radius;
+        real discriminant = b*b - a*c;
+        if (discriminant > 0) {
+            real temp = (-b - sqrt(discriminant))/a;
+            if (temp < closest && temp > t_min) {
+                closest = temp;
+                best = k;
+                continue;
+            }
+            temp = (-b + sqrt(discriminant)) / a;
+            if (temp < closest && temp > t_min) {
+                closest = temp;
+                best = k;
+            }
+        }
+    }
+    return best;
+}
+
+
+bool compact_sphere_set::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    int best_leaf = -1, best = -1;
+    real best_t = t_max;
+    tree.traverse(r, t_min, t_max, [&](int leaf, int count, real& closest_so_far) {
+        int k = hit_leaf(r, leaf, count, t_min, closest_so_far);
+        if (k < 0) return false;
+        best_leaf = leaf;
+        best = k;
+        best_t = closest_so_far;
+        return true;
+    });
+    if (best_leaf < 0) return false;
+    const scene_sphere& s = exact(best_leaf, best);
+    vec3 center(s.center[0], s.center[1], s.center[2]);
+    rec.t = best_t;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / real(s.radius);
+    rec.mat_ptr = palette[palette_of[s.material]];
+    return true;
+}
+
+
+bool compact_sphere_set::bounding_box(aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.nodes[0].box;
+    return true;
+}
+
+
+compact_sphere_set *make_compact_sphere_set(const scene_description& scene, arena& mem) {
+    compact_sphere_set *set = new compact_sphere_set();
+    set->build(scene, mem);
+    return set;
+}
+
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef DENOISEH
+#define DENOISEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <vector>
+#include "framebuffer.h"
+#include "render.h"
+
+
+// Per-pixel guides for the denoiser, averaged over the pixel's lens and jitter samples so they
+// carry the same defocus as the image. Rows run bottom to top like the framebuffer.
+struct aux_buffers {
+    aux_buffers(int w, int h) : nx(w), ny(h), albedo(w*h), normal(w*h), depth(w*h) {}
+
+    int nx, ny;
+    std::vector<vec3> albedo;   // reflectance of the first non-glass surface, or the sky color
+    std::vector<vec3> normal;   // its unit normal, zero for the sky
+    std::vector<real> depth;    // ray t of the first hit, zero for the sky
+};
+
+
+struct denoise_settings {
+    int aux_samples = 8;        // per pixel, for the guide buffers
+    int iterations = 5;         // a-trous passes; the footprint doubles each pass
+    real sigma_color = 4;       // luminance edge stopping, in standard deviations of the noise
+    real sigma_normal = 4;      // exponent on the normals' cosine
+    real sigma_depth = 0.05;    // relative depth difference
+    real sigma_albedo = 0.5;
+};
+
+
+// Follows a camera ray through glass and near-mirror metal to the first surface that scatters
+// diffusely, so whatever is seen in them gets its own edges in the guides.
+void trace_aux(const ray& r, hitable *world, vec3& albedo, vec3& normal, real& depth) {
+    ray cur = r;
+    vec3 tint(1, 1, 1);
+    depth = 0;
+    for (int bounce = 0; bounce < 4; bounce++) {
+        hit_record rec;
+        if (!world->hit(cur, 0.001, MAXFLOAT, rec)) {
+            albedo = tint*sky_color(cur);
+            normal = vec3(0, 0, 0);
+            return;
+        }
+        if (bounce == 0) depth = rec.t;
+        material_kind kind = rec.mat_ptr->kind();
+        bool specular = kind == material_dielectric
+                     || (kind == material_metal && static_cast<const metal*>(rec.mat_ptr)->fuzz < 0.1);
+        vec3 attenuation;
+        ray scattered;
+        if (!specular || !rec.mat_ptr->scatter(cur, rec, attenuation, scattered)) {
+            albedo = tint*rec.mat_ptr->reflectance();
+            normal = rec.normal;
+            return;
+        }
+        tint *= attenuation;
+        cur = scattered;
+    }
+    albedo = tint;
+    normal = vec3(0, 0, 0);
+}
+
+
+// The guide pass: primary rays only, seeded like the render's own samples.
+void render_aux(const camera& cam, hitable *world, const render_settings& settings, int samples,
+                aux_buffers& aux) {
+    std::vector<tile> tiles = make_tiles(aux.nx, aux.ny, settings.tile_size);
+    parallel_for_work_stealing(int(tiles.size()), settings.threads, [&](int job, int) {
+        const tile& t = tiles[job];
+        for (int j = t.y0; j < t.y1; j++) {
+            for (int i = t.x0; i < t.x1; i++) {
+                vec3 albedo(0, 0, 0), normal(0, 0, 0);
+                real depth = 0;
+                for (int s = 0; s < samples; s++) {
+                    thread_rng() = rng_for_sample(j*aux.nx + i, s, settings.frame);
+                    begin_sample(settings.sampling, i, j, s, settings.frame);
+                    double jitter[2];
+                    sample_2d(jitter);
+                    ray r = cam.get_ray(real(i + jitter[0]) / real(aux.nx), real(j + jitter[1]) / real(aux.ny));
+                    vec3 a, n;
+                    real d;
+                    trace_aux(r, world, a, n, d);
+                    albedo += a;
+                    normal += n;
+                    depth += d;
+                }
+                int p = j*aux.nx + i;
+                aux.albedo[p] = albedo / real(samples);
+                real len = normal.length();
+                aux.normal[p] = len > 0 ? normal / len : vec3(0, 0, 0);
+                aux.depth[p] = depth / real(samples);
+            }
+        }
+    });
+}
+
+
+inline real luminance(const vec3& c) {
+    return 0.2126f*c.x() + 0.7152f*c.y() + 0.0722f*c.z();
+}
+
+
+// How much pixel q's guides look like pixel p's: normals, relative depth and albedo.
+inline real guide_weight(const aux_buffers& aux, int p, int q, const denoise_settings& opts) {
+    const vec3& np = aux.normal[p];
+    const vec3& nq = aux.normal[q];
+    bool sky_p = np.squared_length() == 0, sky_q = nq.squared_length() == 0;
+    if (sky_p != sky_q) return 0;
+    real wn = 1;
+    if (!sky_p) {
+        real c = dot(np, nq);
+        wn = c > 0 ? pow(c, opts.sigma_normal) : 0;
+    }
+    real zp = aux.depth[p];
+    vec3 da = aux.albedo[p] - aux.albedo[q];
+    return wn * exp(-fabs(zp - aux.depth[q]) / (opts.sigma_depth*ffmax(zp, real(1e-3)))
+                    - dot(da, da) / (opts.sigma_albedo*opts.sigma_albedo));
+}
+
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance-guided color
+// weight of SVGF (Schied et al. 2017), minus the temporal part. Radiance is divided by albedo
+// first so material color stays out of the blur and is multiplied back at the end. Each pass is
+// a 5x5 B3-spline kernel with holes of 2^pass pixels, weighted by guide_weight() and by how far
+// apart the two luminances are in units of the local noise, so shadow and lighting edges the
+// guides cannot see survive where they stand out of the noise.
+void denoise(const framebuffer& noisy, const aux_buffers& aux, const denoise_settings& opts, int threads,
+             framebuffer& out) {
+    const int nx = noisy.nx, ny = noisy.ny;
+    const size_t n = noisy.pixels.size();
+    const real eps = 1e-3;
+    const real kernel[5] = { 1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16 };
+    std::vector<vec3> cur(n), next(n);
+    std::vector<real> var(n), next_var(n);
+    for (size_t p = 0; p < n; p++) {
+        const vec3& a = aux.albedo[p];
+        cur[p] = noisy.pixels[p] / vec3(ffmax(a.x(), eps), ffmax(a.y(), eps), ffmax(a.z(), eps));
+    }
+
+    // Runs fn(i, j) for every pixel, in bands of rows spread over the threads.
+    const int band = 8;
+    auto for_each_pixel = [&](auto fn) {
+        parallel_for_work_stealing((ny + band - 1) / band, threads, [&](int b, int) {
+            for (int j = b*band; j < ny && j < (b+1)*band; j++)
+                for (int i = 0; i < nx; i++)
+                    fn(i, j);
+        });
+    };
+
+    // The renderers keep no per-pixel second moments, so the noise is estimated from the
+    // luminance spread over each pixel's geometrically similar 5x5 neighbours.
+    for_each_pixel([&](int i, int j) {
+        int p = j*nx + i;
+        real m1 = 0, m2 = 0, wsum = 0;
+        for (int y = j-2; y <= j+2; y++) {
+            for (int x = i-2; x <= i+2; x++) {
+                if (x < 0 || x >= nx || y < 0 || y >= ny) continue;
+                int q = y*nx + x;
+                real w = q == p ? 1 : guide_weight(aux, p, q, opts);
+                real l = luminance(cur[q]);
+                m1 += w*l;
+                m2 += w*l*l;
+                wsum += w;
+            }
+        }
+        m1 /= wsum;
+        var[p] = ffmax(real(0), m2/wsum - m1*m1);
+    });
+
+    for (int pass = 0; pass < opts.iterations; pass++) {
+        const int step = 1 << pass;
+        for_each_pixel([&](int i, int j) {
+            int p = j*nx + i;
+            // the variance is itself noisy, so the color weight uses a 3x3 blur of it
+            real v = 0, vw = 0;
+            for (int y = j-1; y <= j+1; y++) {
+                for (int x = i-1; x <= i+1; x++) {
+                    if (x < 0 || x >= nx || y < 0 || y >= ny) continue;
+                    real w = kernel[x-i+2] * kernel[y-j+2];
+                    v += w*var[y*nx + x];
+                    vw += w;
+                }
+            }
+            real inv_sigma = 1 / (opts.sigma_color*sqrt(v/vw) + real(1e-4));
+            real lp = luminance(cur[p]);
+            vec3 sum(0, 0, 0);
+            real wsum = 0, vsum = 0;
+            for (int dy = -2; dy <= 2; dy++) {
+                int y = j + dy*step;
+                if (y < 0 || y >= ny) continue;
+                for (int dx = -2; dx <= 2; dx++) {
+                    int x = i + dx*step;
+                    if (x < 0 || x >= nx) continue;
+                    int q = y*nx + x;
+                    real w = kernel[dx+2]*kernel[dy+2];
+                    if (q != p)
+                        w *= guide_weight(aux, p, q, opts) * exp(-fabs(lp - luminance(cur[q])) * inv_sigma);
+                    sum += w*cur[q];
+                    wsum += w;
+                    vsum += w*w*var[q];
+                }
+            }
+            next[p] = sum / wsum;
+            next_var[p] = vsum / (wsum*wsum);
+        });
+        cur.swap(next);
+        var.swap(next_var);
+    }
+
+    out = framebuffer(nx, ny);
+    for (size_t p = 0; p < n; p++) {
+        const vec3& a = aux.albedo[p];
+        out.pixels[p] = cur[p] * vec3(ffmax(a.x(), eps), ffmax(a.y(), eps), ffmax(a.z(), eps));
+    }
+}
+
+
+enum aux_channel { aux_albedo, aux_normal, aux_depth };
+
+// One guide as an image, for inspection or an external denoiser: albedo as is, normals mapped
+// from [-1,1] to [0,1], and depth normalized by the farthest hit.
+framebuffer aux_image(const aux_buffers& aux, aux_channel channel) {
+    framebuffer fb(aux.nx, aux.ny);
+    real far = 0;
+    for (real d : aux.depth) far = ffmax(far, d);
+    for (size_t p = 0; p < fb.pixels.size(); p++) {
+        switch (channel) {
+            case aux_albedo: fb.pixels[p] = aux.albedo[p]; break;
+            case aux_normal: fb.pixels[p] = 0.5*(aux.normal[p] + vec3(1, 1, 1)); break;
+            case aux_depth:  fb.pixels[p] = vec3(1, 1, 1) * (far > 0 ? aux.depth[p] / far : 0); break;
+        }
+    }
+    return fb;
+}
+
+
+#endif
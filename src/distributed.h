@@ -0,0 +1,438 @@
+#ifndef DISTRIBUTEDH
+#define DISTRIBUTEDH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// Distributed tile rendering over TCP. A coordinator holds the scene and the framebuffer; workers
+// connect, receive the scene in its binary form plus the render parameters, and then render tiles
+// on request and send back float radiance. Samples are seeded from (pixel, sample, frame), so a
+// tile's result does not depend on which worker rendered it; that lets the coordinator reissue
+// the work of a dead worker, and duplicate the oldest outstanding tiles onto idle workers near
+// the end so a slow worker cannot hold up the frame.
+//
+// Messages are a 4-byte type and a 4-byte payload length followed by the payload, all in native
+// byte order, so every machine in a render must share endianness.
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DISTRIBUTED_AVAILABLE 1
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "render.h"
+#include "scene.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+enum net_message_type { msg_setup = 1, msg_job = 2, msg_result = 3, msg_shutdown = 4 };
+
+struct net_header {
+    uint32_t type;
+    uint32_t length;
+};
+
+// The largest payload the header's length field can describe.
+static const size_t max_message_length = UINT32_MAX;
+
+// Render parameters sent ahead of the scene in msg_setup.
+struct net_setup {
+    int32_t nx, ny, ns, frame;
+    int32_t russian_roulette, min_depth, max_depth;
+    int32_t sampling;       // a sampler_type
+};
+
+struct net_job {
+    int32_t id;
+    int32_t x0, y0, x1, y1;
+};
+
+
+bool send_all(int fd, const void *data, size_t n) {
+    const char *p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+
+bool recv_all(int fd, void *data, size_t n) {
+    char *p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+
+// Sends a then b as one message. Fails without sending anything when the two together are longer
+// than max_message_length, rather than truncating the length and desynchronizing the stream.
+bool send_message(int fd, uint32_t type, const void *a, size_t na, const void *b = 0, size_t nb = 0) {
+    if (na > max_message_length || nb > max_message_length - na) return false;
+    net_header h = { type, uint32_t(na + nb) };
+    return send_all(fd, &h, sizeof(h)) && send_all(fd, a, na) && (nb == 0 || send_all(fd, b, nb));
+}
+
+
+// The longest payload each side accepts per message type; a type left at zero may only arrive
+// empty. Checked against the header before anything is allocated, so a bad peer cannot make the
+// receiver reserve up to 4 GiB.
+struct message_limits {
+    size_t setup = 0, job = 0, result = 0, shutdown = 0;
+
+    size_t operator()(uint32_t type) const {
+        switch (type) {
+            case msg_setup: return setup;
+            case msg_job: return job;
+            case msg_result: return result;
+            case msg_shutdown: return shutdown;
+        }
+        return 0;
+    }
+};
+
+
+bool recv_message(int fd, uint32_t& type, std::vector<char>& payload, const message_limits& limits) {
+    net_header h;
+    if (!recv_all(fd, &h, sizeof(h))) return false;
+    type = h.type;
+    if (h.length > limits(h.type)) return false;
+    payload.resize(h.length);
+    return h.length == 0 || recv_all(fd, &payload[0], h.length);
+}
+
+
+// Returns a listening socket, or -1: on loopback only when local is set, otherwise on all
+// interfaces. Port 0 picks a free port, reported in port.
+int listen_on(int& port, bool local) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(local ? INADDR_LOOPBACK : INADDR_ANY);
+    addr.sin_port = htons(uint16_t(port));
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0
+        || getsockname(fd, (sockaddr*)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+
+// "host:port" to a connected socket, or -1.
+int connect_to(const char *address) {
+    std::string a(address);
+    size_t colon = a.rfind(':');
+    if (colon == std::string::npos) return -1;
+    std::string host = a.substr(0, colon), port = a.substr(colon+1);
+    addrinfo hints, *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo *p = res; p; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+
+// Worker side: connect, take the scene, render tiles with every local thread until told to stop.
+// Returns false if the connection failed before a clean shutdown.
+bool run_worker(const char *address, int threads) {
+    int fd = connect_to(address);
+    if (fd < 0) {
+        std::cerr << "worker: cannot connect to " << address << "\n";
+        return false;
+    }
+    // the setup carries the whole scene, which has no fixed bound; jobs are one net_job each
+    message_limits limits;
+    limits.setup = max_message_length;
+    limits.job = sizeof(net_job);
+    uint32_t type;
+    std::vector<char> payload;
+    if (!recv_message(fd, type, payload, limits) || type != msg_setup || payload.size() < sizeof(net_setup)) {
+        close(fd);
+        return false;
+    }
+    net_setup setup;
+    memcpy(&setup, &payload[0], sizeof(setup));
+    std::vector<char> scene_bytes(payload.begin() + sizeof(setup), payload.end());
+    scene_description scene;
+    std::string error;
+    if (!read_scene_memory(scene_bytes, scene, error)) {
+        std::cerr << "worker: " << error << "\n";
+        close(fd);
+        return false;
+    }
+    arena mem;
+    std::vector<material*> mats = make_materials(scene, mem);
+    sphere_set *world = make_sphere_set(scene, mats);
+    camera cam = scene.make_camera(float(setup.nx) / float(setup.ny));
+
+    render_settings settings;
+    settings.ns = setup.ns;
+    settings.frame = setup.frame;
+    settings.threads = threads;
+    settings.paths.russian_roulette = setup.russian_roulette != 0;
+    settings.paths.min_depth = setup.min_depth;
+    settings.paths.max_depth = setup.max_depth;
+    settings.sampling = get_sampler(sampler_type(setup.sampling));
+    framebuffer fb(setup.nx, setup.ny);
+
+    bool ok = false;
+    std::vector<float> result;
+    while (recv_message(fd, type, payload, limits)) {
+        if (type == msg_shutdown) { ok = true; break; }
+        if (type != msg_job || payload.size() != sizeof(net_job)) break;
+        net_job job;
+        memcpy(&job, &payload[0], sizeof(job));
+        tile t = { job.x0, job.y0, job.x1, job.y1 };
+        // split the job so every local thread has work
+        std::vector<tile> parts = make_tiles(t.x1 - t.x0, t.y1 - t.y0, 16);
+        parallel_for_work_stealing(int(parts.size()), threads, [&](int k, int) {
+            tile p = { parts[k].x0 + t.x0, parts[k].y0 + t.y0, parts[k].x1 + t.x0, parts[k].y1 + t.y0 };
+            path_stats stats;
+            render_tile(p, cam, world, settings, fb, stats);
+        });
+        result.clear();
+        for (int j = t.y0; j < t.y1; j++)
+            for (int i = t.x0; i < t.x1; i++)
+                result.insert(result.end(), fb.at(i, j).e, fb.at(i, j).e + 3);
+        if (!send_message(fd, msg_result, &job.id, sizeof(job.id), result.data(), result.size()*sizeof(float)))
+            break;
+    }
+    close(fd);
+    delete world;
+    return ok;
+}
+
+
+struct coordinator_settings {
+    int port = 0;
+    int tile_size = 64;
+    int jobs_in_flight = 2;     // per worker, so a worker never idles waiting for its next job
+    sampler_type sampling = sampler_random;     // sent to workers, which look up their own sampler
+};
+
+
+// Coordinator side: serve tiles of fb to whichever workers connect on listen_fd until every tile
+// is back. Single-threaded around poll(); results are small relative to render time.
+bool run_coordinator(int listen_fd, const scene_description& scene, const render_settings& settings,
+                     const coordinator_settings& coord, framebuffer& fb) {
+    typedef std::chrono::steady_clock clock;
+    struct worker_link {
+        int fd;
+        std::vector<int> jobs;      // outstanding tile ids
+    };
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, coord.tile_size);
+    std::vector<char> done(tiles.size(), 0);
+    std::vector<clock::time_point> issued(tiles.size());
+    std::deque<int> pending;
+    for (int k = 0; k < int(tiles.size()); k++)
+        pending.push_back(k);
+    int remaining = int(tiles.size());
+    // a result is a tile id followed by the tile's radiance, so no larger than the largest tile's
+    message_limits limits;
+    for (const tile& t : tiles) {
+        size_t floats = size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3;
+        limits.result = std::max(limits.result, sizeof(int32_t) + floats*sizeof(float));
+    }
+
+    net_setup setup = { fb.nx, fb.ny, settings.ns, settings.frame, settings.paths.russian_roulette ? 1 : 0,
+                        settings.paths.min_depth, settings.paths.max_depth, coord.sampling };
+    std::vector<char> scene_bytes = scene_to_binary(scene);
+    if (scene_bytes.size() > max_message_length - sizeof(setup)) {
+        std::cerr << "coordinator: the scene is " << scene_bytes.size() << " bytes, more than one message can carry\n";
+        return false;
+    }
+    std::vector<worker_link> workers;
+    std::vector<char> payload;
+
+    while (remaining > 0) {
+        std::vector<pollfd> fds(1 + workers.size());
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t w = 0; w < workers.size(); w++) {
+            fds[w+1].fd = workers[w].fd;
+            fds[w+1].events = POLLIN;
+        }
+        if (poll(fds.data(), fds.size(), 200) < 0 && errno != EINTR)
+            return false;
+
+        for (size_t w = 0; w < workers.size(); w++) {
+            if (!(fds[w+1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            uint32_t type;
+            bool alive = recv_message(workers[w].fd, type, payload, limits) && type == msg_result
+                      && payload.size() >= sizeof(int32_t);
+            if (alive) {
+                int32_t id;
+                memcpy(&id, &payload[0], sizeof(id));
+                alive = id >= 0 && id < int(tiles.size());
+                if (alive) {
+                    const tile& t = tiles[id];
+                    size_t floats = size_t(t.x1 - t.x0) * (t.y1 - t.y0) * 3;
+                    alive = payload.size() == sizeof(id) + floats*sizeof(float);
+                    if (alive && !done[id]) {
+                        const char *src = &payload[sizeof(id)];
+                        // the wire carries packed floats whatever vec3's layout or precision
+                        for (int j = t.y0; j < t.y1; j++)
+                            for (int i = t.x0; i < t.x1; i++, src += 3*sizeof(float)) {
+                                float c[3];
+                                memcpy(c, src, sizeof(c));
+                                fb.at(i, j) = vec3(c[0], c[1], c[2]);
+                            }
+                        done[id] = 1;
+                        remaining--;
+                    }
+                    std::vector<int>& jobs = workers[w].jobs;
+                    for (size_t k = 0; k < jobs.size(); k++)
+                        if (jobs[k] == id) { jobs.erase(jobs.begin() + k); break; }
+                }
+            }
+            if (!alive) {
+                // requeue the dead worker's unfinished tiles at the front
+                for (int id : workers[w].jobs)
+                    if (!done[id]) pending.push_front(id);
+                close(workers[w].fd);
+                workers[w].fd = -1;
+            }
+        }
+        for (size_t w = 0; w < workers.size(); ) {
+            if (workers[w].fd < 0) workers.erase(workers.begin() + w);
+            else w++;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, 0, 0);
+            if (fd >= 0) {
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                if (send_message(fd, msg_setup, &setup, sizeof(setup), scene_bytes.data(), scene_bytes.size())) {
+                    worker_link link = { fd, std::vector<int>() };
+                    workers.push_back(link);
+                }
+                else {
+                    close(fd);
+                }
+            }
+        }
+
+        for (worker_link& w : workers) {
+            while (int(w.jobs.size()) < coord.jobs_in_flight) {
+                int id = -1;
+                while (!pending.empty() && id < 0) {
+                    id = pending.front();
+                    pending.pop_front();
+                    if (done[id]) id = -1;
+                }
+                if (id < 0 && w.jobs.empty()) {
+                    // Nothing left to hand out: duplicate the longest-outstanding tile held by
+                    // another worker. Whichever copy returns first is kept.
+                    clock::time_point oldest = clock::now();
+                    for (const worker_link& other : workers) {
+                        if (&other == &w) continue;
+                        for (int j : other.jobs)
+                            if (!done[j] && issued[j] < oldest) { oldest = issued[j]; id = j; }
+                    }
+                }
+                if (id < 0) break;
+                const tile& t = tiles[id];
+                net_job job = { id, t.x0, t.y0, t.x1, t.y1 };
+                if (!send_message(w.fd, msg_job, &job, sizeof(job))) {
+                    pending.push_front(id);
+                    break;
+                }
+                issued[id] = clock::now();
+                w.jobs.push_back(id);
+            }
+        }
+    }
+
+    for (worker_link& w : workers) {
+        send_message(w.fd, msg_shutdown, 0, 0);
+        close(w.fd);
+    }
+    return true;
+}
+
+
+// Forks n worker processes that connect back to this machine on port; used for local testing
+// and for using every core of the coordinator's own box.
+std::vector<pid_t> spawn_local_workers(int n, int port, int threads) {
+    std::vector<pid_t> pids;
+    std::string address = "127.0.0.1:" + std::to_string(port);
+    for (int k = 0; k < n; k++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            bool ok = run_worker(address.c_str(), threads);
+            _exit(ok ? 0 : 1);
+        }
+        if (pid > 0) pids.push_back(pid);
+    }
+    return pids;
+}
+
+
+void wait_for_workers(const std::vector<pid_t>& pids) {
+    for (pid_t pid : pids) {
+        int status;
+        waitpid(pid, &status, 0);
+    }
+}
+
+#endif
+
+
+#endif
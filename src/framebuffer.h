@@ -0,0 +1,155 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "vec3.h"
+
+
+// Linear radiance for every pixel, row 0 at the bottom of the image as in the camera's (u,v).
+class framebuffer {
+    public:
+        framebuffer(int w, int h) : nx(w), ny(h), pixels(w*h, vec3(0,0,0)) {}
+        vec3& at(int i, int j) { return pixels[j*nx + i]; }
+        const vec3& at(int i, int j) const { return pixels[j*nx + i]; }
+
+        // Rows [j0, j1) as 3 packed floats per pixel, whatever vec3's precision and padding.
+        void pack_rows(int j0, int j1, float *out) const {
+            for (size_t p = size_t(j0)*nx; p < size_t(j1)*nx; p++) {
+                *out++ = float(pixels[p].e[0]);
+                *out++ = float(pixels[p].e[1]);
+                *out++ = float(pixels[p].e[2]);
+            }
+        }
+        std::vector<float> packed() const {
+            std::vector<float> out(pixels.size()*3);
+            if (!out.empty()) pack_rows(0, ny, &out[0]);
+            return out;
+        }
+
+        int nx, ny;
+        std::vector<vec3> pixels;
+};
+
+
+enum image_format { image_p3, image_p6, image_pfm, image_raw };
+
+
+// Returns false for an unknown name.
+bool parse_image_format(const char *name, image_format& format) {
+    if (!strcmp(name, "p3")) format = image_p3;
+    else if (!strcmp(name, "p6")) format = image_p6;
+    else if (!strcmp(name, "pfm")) format = image_pfm;
+    else if (!strcmp(name, "raw")) format = image_raw;
+    else return false;
+    return true;
+}
+
+
+// Gamma 2 and 8-bit quantization as one flat pass over a row of floats, with no per-pixel branches
+// so the compiler can vectorize it.
+inline void quantize_row(const float *in, int n, unsigned char *out) {
+    for (int k = 0; k < n; k++) {
+        float c = sqrtf(in[k]);
+        c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+        out[k] = (unsigned char)(int)(255.99*c);
+    }
+}
+
+
+// 8-bit RGB, rows top to bottom as PPM expects.
+std::vector<unsigned char> quantize(const framebuffer& fb) {
+    std::vector<unsigned char> out(size_t(fb.nx)*fb.ny*3);
+    std::vector<float> row(size_t(fb.nx)*3);
+    for (int j = 0; j < fb.ny; j++) {
+        fb.pack_rows(j, j+1, row.data());
+        quantize_row(row.data(), fb.nx*3, &out[size_t(fb.ny-1-j)*fb.nx*3]);
+    }
+    return out;
+}
+
+
+// Each writer assembles the header and payload so the file goes out in one large fwrite.
+
+bool write_bytes(FILE *f, const std::string& header, const void *payload, size_t size) {
+    std::vector<char> buffer(header.size() + size);
+    memcpy(&buffer[0], header.data(), header.size());
+    if (size) memcpy(&buffer[header.size()], payload, size);
+    return fwrite(&buffer[0], 1, buffer.size(), f) == buffer.size();
+}
+
+
+bool write_p6(FILE *f, const framebuffer& fb) {
+    std::vector<unsigned char> rgb = quantize(fb);
+    std::string header = "P6\n" + std::to_string(fb.nx) + " " + std::to_string(fb.ny) + "\n255\n";
+    return write_bytes(f, header, rgb.data(), rgb.size());
+}
+
+
+bool write_p3(FILE *f, const framebuffer& fb) {
+    std::vector<unsigned char> rgb = quantize(fb);
+    std::string text = "P3\n" + std::to_string(fb.nx) + " " + std::to_string(fb.ny) + "\n255\n";
+    text.reserve(text.size() + rgb.size()*4);
+    for (size_t k = 0; k < rgb.size(); k += 3) {
+        text += std::to_string(rgb[k]) + " " + std::to_string(rgb[k+1]) + " " + std::to_string(rgb[k+2]) + "\n";
+    }
+    return write_bytes(f, text, 0, 0);
+}
+
+
+// PFM rows run bottom to top, like the framebuffer, and a negative scale marks little-endian data.
+bool write_pfm(FILE *f, const framebuffer& fb) {
+    const unsigned int one = 1;
+    bool little_endian = *(const unsigned char*)&one == 1;
+    std::string header = "PF\n" + std::to_string(fb.nx) + " " + std::to_string(fb.ny) + "\n"
+                       + (little_endian ? "-1.0\n" : "1.0\n");
+    std::vector<float> data = fb.packed();
+    return write_bytes(f, header, data.data(), data.size()*sizeof(float));
+}
+
+
+// Headerless native-endian floats, 3 per pixel, rows bottom to top.
+bool write_raw(FILE *f, const framebuffer& fb) {
+    std::vector<float> data = fb.packed();
+    return write_bytes(f, std::string(), data.data(), data.size()*sizeof(float));
+}
+
+
+bool write_image(FILE *f, const framebuffer& fb, image_format format) {
+    switch (format) {
+        case image_p3:  return write_p3(f, fb);
+        case image_p6:  return write_p6(f, fb);
+        case image_pfm: return write_pfm(f, fb);
+        case image_raw: return write_raw(f, fb);
+    }
+    return false;
+}
+
+
+// Writes to stdout when path is null or "-".
+bool write_image(const char *path, const framebuffer& fb, image_format format) {
+    if (!path || !strcmp(path, "-")) {
+        bool ok = write_image(stdout, fb, format);
+        return fflush(stdout) == 0 && ok;
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    bool ok = write_image(f, fb, format);
+    return fclose(f) == 0 && ok;
+}
+
+
+#endif
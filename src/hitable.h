@@ -12,12 +12,13 @@
 //==================================================================================================
 
 #include "ray.h"
+#include "aabb.h"
 
 class material;
 
 struct hit_record
 {
-    float t;
+    real t;
     vec3 p;
     vec3 normal;
     material *mat_ptr;
@@ -25,7 +26,9 @@ struct hit_record
 
 class hitable  {
     public:
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        virtual ~hitable() {}
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(aabb& box) const = 0;
 };
 
 
@@ -17,12 +17,13 @@ class hitable_list: public hitable  {
     public:
         hitable_list() {}
         hitable_list(hitable **l, int n) { list = l; list_size = n; }
-        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
         hitable **list;
         int list_size;
 };
 
-bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+bool hitable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     bool hit_anything = false;
     double closest_so_far = t_max;
@@ -37,4 +38,19 @@ bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec)
 }
 
 
+bool hitable_list::bounding_box(aabb& box) const {
+    if (list_size < 1) return false;
+    aabb temp_box;
+    if (!list[0]->bounding_box(temp_box))
+        return false;
+    box = temp_box;
+    for (int i = 1; i < list_size; i++) {
+        if (!list[i]->bounding_box(temp_box))
+            return false;
+        box = surrounding_box(box, temp_box);
+    }
+    return true;
+}
+
+
 #endif
@@ -0,0 +1,529 @@
+#ifndef INCREMENTALH
+#define INCREMENTALH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "render.h"
+#include "scene.h"
+#include "sphere_set.h"
+
+
+// A uniform grid of cells over the part of the scene where ordinary-sized objects sit, used to
+// remember where a tile's rays went. Cell sets are bitsets of words() 64-bit words.
+class cell_grid {
+    public:
+        cell_grid() {}
+        cell_grid(const aabb& region, int target_cells) {
+            lo = region.min();
+            hi = region.max();
+            vec3 extent = hi - lo;
+            real volume = ffmax(extent.x(), 1e-3) * ffmax(extent.y(), 1e-3) * ffmax(extent.z(), 1e-3);
+            real side = cbrt(volume / target_cells);
+            for (int a = 0; a < 3; a++) {
+                n[a] = std::max(1, int(ceil(extent[a] / side)));
+                cell[a] = ffmax(extent[a], 1e-3) / n[a];
+                inv_cell[a] = 1 / cell[a];
+            }
+        }
+
+        int cells() const { return n[0]*n[1]*n[2]; }
+        int words() const { return (cells() + 63) / 64; }
+
+        // Marks the cells of box, grown by a hundredth of a cell so that a ray that mark() sent
+        // through a neighbouring cell by rounding, where it only grazed one of these, still meets
+        // it. Returns false if the box reaches outside the grid.
+        bool cover(const aabb& box, std::vector<uint64_t>& bits) const {
+            int c0[3], c1[3];
+            bool inside = true;
+            for (int a = 0; a < 3; a++) {
+                if (!(box.min()[a] >= lo[a] && box.max()[a] <= hi[a])) inside = false;
+                real pad = 0.01 * cell[a];
+                c0[a] = clamp(int(floor((box.min()[a] - pad - lo[a]) / cell[a])), a);
+                c1[a] = clamp(int(floor((box.max()[a] + pad - lo[a]) / cell[a])), a);
+            }
+            for (int z = c0[2]; z <= c1[2]; z++)
+                for (int y = c0[1]; y <= c1[1]; y++)
+                    for (int x = c0[0]; x <= c1[0]; x++)
+                        set(x, y, z, bits);
+            return inside;
+        }
+
+        // Marks the cells that r passes through for t in [t0, t1], t1 possibly infinite, by a
+        // 3D DDA. Returns false if part of the segment lies outside the grid.
+        bool mark(const ray& r, real t0, real t1, std::vector<uint64_t>& bits) const {
+            real enter = t0, leave = t1;
+            real inv[3];
+            for (int a = 0; a < 3; a++) {
+                real o = r.origin()[a], d = r.direction()[a];
+                if (d == 0) {
+                    if (o < lo[a] || o > hi[a]) return false;
+                    inv[a] = 0;
+                    continue;
+                }
+                inv[a] = 1 / d;
+                real ta = (lo[a] - o) * inv[a], tb = (hi[a] - o) * inv[a];
+                if (ta > tb) std::swap(ta, tb);
+                enter = ffmax(enter, ta);
+                leave = ffmin(leave, tb);
+            }
+            bool inside = enter == t0 && leave == t1;
+            if (!(enter <= leave)) return false;
+            // Walk the segment one cell-thick slab at a time along its dominant axis m, marking
+            // the one to four cells each slab's piece spans across the other two. Unlike stepping
+            // cell to cell this never has to guess which axis comes next.
+            real o[3] = { r.origin()[0], r.origin()[1], r.origin()[2] };
+            real d[3] = { r.direction()[0], r.direction()[1], r.direction()[2] };
+            int m = fabs(d[0]) > fabs(d[1]) ? (fabs(d[0]) > fabs(d[2]) ? 0 : 2) : (fabs(d[1]) > fabs(d[2]) ? 1 : 2);
+            int u = m == 0 ? 1 : 0, v = m == 2 ? 1 : 2;
+            int last = clamp(int((o[m] + leave*d[m] - lo[m]) * inv_cell[m]), m);
+            int c = clamp(int((o[m] + enter*d[m] - lo[m]) * inv_cell[m]), m);
+            int s = d[m] > 0 ? 1 : -1;
+            int u0 = clamp(int((o[u] + enter*d[u] - lo[u]) * inv_cell[u]), u);
+            int v0 = clamp(int((o[v] + enter*d[v] - lo[v]) * inv_cell[v]), v);
+            int stride[3] = { 1, n[0], n[0]*n[1] };
+            uint64_t *words = bits.data();
+            for (;;) {
+                real t = c == last ? leave : ffmin(leave, (lo[m] + (c + (s > 0)) * cell[m] - o[m]) * inv[m]);
+                int u1 = clamp(int((o[u] + t*d[u] - lo[u]) * inv_cell[u]), u);
+                int v1 = clamp(int((o[v] + t*d[v] - lo[v]) * inv_cell[v]), v);
+                int ua = std::min(u0, u1), ub = std::max(u0, u1);
+                int va = std::min(v0, v1), vb = std::max(v0, v1);
+                for (int j = va; j <= vb; j++) {
+                    for (int i = ua; i <= ub; i++) {
+                        int index = c*stride[m] + i*stride[u] + j*stride[v];
+                        words[index >> 6] |= uint64_t(1) << (index & 63);
+                    }
+                }
+                if (c == last) break;
+                c += s;
+                u0 = u1;
+                v0 = v1;
+            }
+            return inside;
+        }
+
+        vec3 lo, hi;
+        int n[3] = { 1, 1, 1 };
+        real cell[3] = { 1, 1, 1 };
+        real inv_cell[3] = { 1, 1, 1 };
+
+    private:
+        int clamp(int c, int a) const { return c < 0 ? 0 : c >= n[a] ? n[a] - 1 : c; }
+        void set(int x, int y, int z, std::vector<uint64_t>& bits) const {
+            int i = (z*n[1] + y)*n[0] + x;
+            bits[i >> 6] |= uint64_t(1) << (i & 63);
+        }
+};
+
+
+// What the paths of one tile's last trace reached.
+struct tile_record {
+    std::vector<uint64_t> cells;    // grid cells any of its rays passed through
+    bool outside = false;           // some ray left the grid
+    std::vector<int> hits;          // ids of the spheres its rays hit, sorted
+    bool valid = false;
+};
+
+
+// The sphere set seen through a tile's trace: every query goes to the set unchanged, and the
+// ray's extent and the sphere it hit are added to the tile's record on the way out.
+class recording_world : public hitable {
+    public:
+        recording_world() {}
+        recording_world(const sphere_set *s, const std::vector<int> *ids, const cell_grid *g)
+            : set(s), id_of(ids), grid(g) {}
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const {
+            int material, index;
+            bool found = set->hit_indexed(r, tmin, tmax, rec, material, &index);
+            if (!grid->mark(r, 0, found ? rec.t : std::numeric_limits<real>::infinity(), record->cells))
+                record->outside = true;
+            if (found) record->hits.push_back((*id_of)[index]);
+            return found;
+        }
+        virtual bool bounding_box(aabb& box) const { return set->bounding_box(box); }
+
+        const sphere_set *set = 0;
+        const std::vector<int> *id_of = 0;
+        const cell_grid *grid = 0;
+        tile_record *record = 0;
+};
+
+
+// One change to the scene. Spheres are named by id: their index in the scene's table, with
+// added spheres numbered on from the end of it. Materials are indices into the material table,
+// which add_material edits extend.
+enum scene_edit_kind { edit_add_material, edit_add_sphere, edit_move, edit_set_material, edit_remove, edit_render };
+
+struct scene_edit {
+    int kind;
+    int sphere = -1;
+    scene_sphere s = { { 0, 0, 0 }, 0, 0 };     // add_sphere and move; move ignores material
+    scene_material m = { 0, { 0, 0, 0 }, 0 };   // add_material
+};
+
+
+// Edit files take the scene format's material and sphere records, which add to the scene, and
+// these, one per line, '#' starts a comment:
+//     move <sphere> <x y z> [<radius>]
+//     recolor <sphere> <material>
+//     remove <sphere>
+//     render
+// A render record ends a batch of edits; the edits after the last one form a final batch.
+bool read_scene_edits(const char *path, std::vector<scene_edit>& edits, std::string& error) {
+    std::ifstream in(path);
+    if (!in) { error = "cannot open " + std::string(path); return false; }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        scene_edit e;
+        bool ok = true;
+        if (kind == "lambertian" || kind == "metal" || kind == "dielectric") {
+            vec3 albedo(1,1,1);
+            float param = 0;
+            if (kind == "lambertian") ok = bool(ls >> albedo);
+            else if (kind == "metal") ok = bool(ls >> albedo >> param);
+            else ok = bool(ls >> param);
+            int type = kind == "lambertian" ? scene_lambertian : kind == "metal" ? scene_metal : scene_dielectric;
+            e.kind = edit_add_material;
+            e.m = make_scene_material(type, albedo, param);
+        }
+        else if (kind == "sphere") {
+            e.kind = edit_add_sphere;
+            ok = bool(ls >> e.s.center[0] >> e.s.center[1] >> e.s.center[2] >> e.s.radius >> e.s.material);
+        }
+        else if (kind == "move") {
+            e.kind = edit_move;
+            e.s.radius = -1;
+            ok = bool(ls >> e.sphere >> e.s.center[0] >> e.s.center[1] >> e.s.center[2]);
+            if (ok) ls >> e.s.radius;
+        }
+        else if (kind == "recolor") {
+            e.kind = edit_set_material;
+            ok = bool(ls >> e.sphere >> e.s.material);
+        }
+        else if (kind == "remove") {
+            e.kind = edit_remove;
+            ok = bool(ls >> e.sphere);
+        }
+        else if (kind == "render") {
+            e.kind = edit_render;
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            error = std::string(path) + ":" + std::to_string(line_no) + ": bad " + kind + " record";
+            return false;
+        }
+        edits.push_back(e);
+    }
+    return true;
+}
+
+
+struct incremental_stats {
+    int tiles = 0;
+    int traced = 0;             // tiles re-traced by this render
+    bool rebuilt = false;       // the tree was rebuilt rather than refit
+    path_stats paths;
+    double seconds = 0;
+};
+
+
+// Renders a sphere scene that changes between frames, re-tracing only the tiles an edit could
+// have changed. Every tile keeps its pixels and a record of the spheres its rays hit and the grid
+// cells they crossed. Recoloring or removing a sphere can only change paths that hit it; moving
+// or adding one can also change paths that now cross it, which all pass through the cells of its
+// new box. Samples are seeded by pixel, sample and frame, so a re-traced tile comes out exactly
+// as a full render of the edited scene would draw it, and a skipped tile already is.
+//
+// Edits keep the tree: moves and removals refit it and additions go into the leaf that grows
+// least, until an eighth of the spheres have changed shape since the last build, when a refit
+// tree has usually lost much of its quality; then it is rebuilt. Neither changes any hit, so
+// neither invalidates tiles.
+class incremental_renderer {
+    public:
+        // A tile is the unit of invalidation, so these are smaller than render()'s: an 8x8 tile
+        // re-traces about half the rays a 16x16 one does after a local edit, for 4x the records.
+        static const int tile_size = 8;
+        // About 4 KB of cell bits per tile.
+        static const int grid_cells = 1 << 15;
+
+        incremental_renderer(const scene_description& scene, const std::vector<material*>& mats,
+                             const camera& c, const render_settings& s, int nx, int ny);
+
+        int add_material(material *m);
+        int add_sphere(const vec3& center, real radius, int material);
+        bool move_sphere(int id, const vec3& center, real radius);
+        bool set_material(int id, int material);
+        bool remove_sphere(int id);
+        // Applies one edit from an edit file, making its materials in mem. False for bad ids.
+        bool apply(const scene_edit& e, arena& mem);
+
+        // Re-traces every tile the edits since the last call could have changed (all of them
+        // the first time) and copies the whole image into fb.
+        incremental_stats render(framebuffer& fb);
+
+        sphere_set spheres;
+        camera cam;
+        render_settings settings;
+        framebuffer image;
+        std::vector<tile> tiles;
+        std::vector<tile_record> records;
+        cell_grid grid;
+
+    private:
+        void rebuild();
+
+        std::vector<int> slot_of;       // sphere id to position in spheres, -1 once removed
+        std::vector<int> id_of;         // position in spheres to sphere id
+        std::vector<int> dirty_ids;     // tiles that hit these are stale
+        std::vector<uint64_t> dirty_cells;  // tiles that crossed these are stale
+        bool dirty_outside = false;     // tiles with rays outside the grid are stale
+        bool geometry_changed = false;
+        int reshaped = 0;               // spheres added, moved or removed since the last build
+        int dead = 0;
+};
+
+
+incremental_renderer::incremental_renderer(const scene_description& scene, const std::vector<material*>& mats,
+                                           const camera& c, const render_settings& s, int nx, int ny)
+    : cam(c), settings(s), image(nx, ny) {
+    spheres.materials = mats;
+    spheres.reserve(scene.num_spheres);
+    std::vector<real> radii;
+    for (size_t i = 0; i < scene.num_spheres; i++) {
+        const scene_sphere& sp = scene.spheres[i];
+        spheres.add(vec3(sp.center[0], sp.center[1], sp.center[2]), sp.radius, int(sp.material));
+        radii.push_back(sp.radius);
+    }
+    spheres.build(&id_of);
+    slot_of.assign(id_of.size(), 0);
+    for (size_t p = 0; p < id_of.size(); p++) slot_of[id_of[p]] = int(p);
+
+    // The grid spans the ordinary spheres, leaving out ground-sized ones that would stretch its
+    // cells over empty space, plus a margin for edits that move things a little way out.
+    aabb region(vec3(0, 0, 0), vec3(0, 0, 0));
+    if (!radii.empty()) {
+        std::vector<real> sorted(radii);
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+        real limit = 8 * sorted[sorted.size()/2];
+        bool first = true;
+        for (size_t i = 0; i < scene.num_spheres; i++) {
+            const scene_sphere& sp = scene.spheres[i];
+            if (sp.radius > limit) continue;
+            vec3 ctr(sp.center[0], sp.center[1], sp.center[2]);
+            vec3 rr(sp.radius, sp.radius, sp.radius);
+            aabb box(ctr - rr, ctr + rr);
+            region = first ? box : surrounding_box(region, box);
+            first = false;
+        }
+    }
+    vec3 margin = 0.25 * (region.max() - region.min()) + vec3(1, 1, 1);
+    grid = cell_grid(aabb(region.min() - margin, region.max() + margin), grid_cells);
+
+    tiles = make_tiles(nx, ny, tile_size);
+    records.resize(tiles.size());
+    dirty_cells.assign(grid.words(), 0);
+}
+
+
+int incremental_renderer::add_material(material *m) {
+    spheres.materials.push_back(m);
+    return int(spheres.materials.size()) - 1;
+}
+
+
+int incremental_renderer::add_sphere(const vec3& center, real radius, int material) {
+    if (material < 0 || material >= int(spheres.materials.size())) return -1;
+    int id = int(slot_of.size());
+    vec3 rr(radius, radius, radius);
+    if (!grid.cover(aabb(center - rr, center + rr), dirty_cells)) dirty_outside = true;
+    geometry_changed = true;
+    reshaped++;
+    int pos = spheres.insert(center, radius, material);
+    if (pos < 0) {
+        // no leaf to take it: append and start the tree over
+        slot_of.push_back(spheres.num_spheres);
+        id_of.push_back(id);
+        spheres.add(center, radius, material);
+        rebuild();
+        return id;
+    }
+    for (int& s : slot_of)
+        if (s >= pos) s++;
+    slot_of.push_back(pos);
+    id_of.insert(id_of.begin() + pos, id);
+    return id;
+}
+
+
+bool incremental_renderer::move_sphere(int id, const vec3& center, real radius) {
+    if (id < 0 || id >= int(slot_of.size()) || slot_of[id] < 0) return false;
+    int p = slot_of[id];
+    dirty_ids.push_back(id);
+    vec3 rr(radius, radius, radius);
+    if (!grid.cover(aabb(center - rr, center + rr), dirty_cells)) dirty_outside = true;
+    spheres.cx[p] = center.x();
+    spheres.cy[p] = center.y();
+    spheres.cz[p] = center.z();
+    spheres.radius[p] = radius;
+    geometry_changed = true;
+    reshaped++;
+    return true;
+}
+
+
+bool incremental_renderer::set_material(int id, int material) {
+    if (id < 0 || id >= int(slot_of.size()) || slot_of[id] < 0) return false;
+    if (material < 0 || material >= int(spheres.materials.size())) return false;
+    dirty_ids.push_back(id);
+    spheres.mat_index[slot_of[id]] = material;
+    return true;
+}
+
+
+bool incremental_renderer::remove_sphere(int id) {
+    if (id < 0 || id >= int(slot_of.size()) || slot_of[id] < 0) return false;
+    dirty_ids.push_back(id);
+    spheres.erase(slot_of[id]);
+    slot_of[id] = -1;
+    dead++;
+    reshaped++;
+    geometry_changed = true;
+    return true;
+}
+
+
+bool incremental_renderer::apply(const scene_edit& e, arena& mem) {
+    vec3 center(e.s.center[0], e.s.center[1], e.s.center[2]);
+    switch (e.kind) {
+        case edit_add_material: {
+            vec3 albedo(e.m.albedo[0], e.m.albedo[1], e.m.albedo[2]);
+            if (e.m.type == scene_lambertian) add_material(mem.create<lambertian>(albedo));
+            else if (e.m.type == scene_metal) add_material(mem.create<metal>(albedo, e.m.param));
+            else add_material(mem.create<dielectric>(e.m.param));
+            return true;
+        }
+        case edit_add_sphere:
+            return add_sphere(center, e.s.radius, e.s.material) >= 0;
+        case edit_move: {
+            if (e.sphere < 0 || e.sphere >= int(slot_of.size()) || slot_of[e.sphere] < 0) return false;
+            real radius = e.s.radius >= 0 ? real(e.s.radius) : spheres.radius[slot_of[e.sphere]];
+            return move_sphere(e.sphere, center, radius);
+        }
+        case edit_set_material:
+            return set_material(e.sphere, e.s.material);
+        case edit_remove:
+            return remove_sphere(e.sphere);
+    }
+    return true;
+}
+
+
+// A fresh tree over the live spheres, renumbering positions but not ids.
+void incremental_renderer::rebuild() {
+    sphere_set fresh;
+    fresh.materials = spheres.materials;
+    fresh.reserve(spheres.num_spheres - dead);
+    std::vector<int> ids;
+    for (int p = 0; p < spheres.num_spheres; p++) {
+        if (!spheres.live(p)) continue;
+        fresh.add(vec3(spheres.cx[p], spheres.cy[p], spheres.cz[p]), spheres.radius[p], spheres.mat_index[p]);
+        ids.push_back(id_of[p]);
+    }
+    std::vector<int> order;
+    fresh.build(&order);
+    id_of.resize(order.size());
+    for (size_t p = 0; p < order.size(); p++) {
+        id_of[p] = ids[order[p]];
+        slot_of[id_of[p]] = int(p);
+    }
+    std::swap(spheres, fresh);
+    dead = 0;
+    reshaped = 0;
+}
+
+
+incremental_stats incremental_renderer::render(framebuffer& fb) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    incremental_stats result;
+    result.tiles = int(tiles.size());
+    if (geometry_changed) {
+        if (reshaped > spheres.num_spheres / 8) {
+            rebuild();
+            result.rebuilt = true;
+        }
+        else {
+            spheres.refit();
+        }
+        geometry_changed = false;
+    }
+
+    std::sort(dirty_ids.begin(), dirty_ids.end());
+    std::vector<int> stale;
+    for (int t = 0; t < int(tiles.size()); t++) {
+        const tile_record& rec = records[t];
+        bool hit = !rec.valid || (dirty_outside && rec.outside);
+        for (size_t w = 0; !hit && w < rec.cells.size(); w++)
+            hit = (rec.cells[w] & dirty_cells[w]) != 0;
+        for (size_t i = 0, j = 0; !hit && i < rec.hits.size() && j < dirty_ids.size(); ) {
+            if (rec.hits[i] < dirty_ids[j]) i++;
+            else if (rec.hits[i] > dirty_ids[j]) j++;
+            else hit = true;
+        }
+        if (hit) stale.push_back(t);
+    }
+
+    const int nthreads = settings.threads < 1 ? 1 : settings.threads;
+    std::vector<recording_world> worlds(nthreads, recording_world(&spheres, &id_of, &grid));
+    std::vector<path_stats> per_thread(nthreads);
+    parallel_for_work_stealing(int(stale.size()), settings.threads, [&](int job, int thread) {
+        tile_record& rec = records[stale[job]];
+        rec.cells.assign(grid.words(), 0);
+        rec.outside = false;
+        rec.hits.clear();
+        worlds[thread].record = &rec;
+        render_tile(tiles[stale[job]], cam, &worlds[thread], settings, image, per_thread[thread]);
+        std::sort(rec.hits.begin(), rec.hits.end());
+        rec.hits.erase(std::unique(rec.hits.begin(), rec.hits.end()), rec.hits.end());
+        rec.valid = true;
+    });
+    for (const path_stats& s : per_thread)
+        result.paths.add(s);
+
+    dirty_ids.clear();
+    std::fill(dirty_cells.begin(), dirty_cells.end(), 0);
+    dirty_outside = false;
+    fb.pixels = image.pixels;
+    result.traced = int(stale.size());
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef INSTRUMENTH
+#define INSTRUMENTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// Render counters, compiled in only when RT_INSTRUMENT is defined (the RTWEEKEND_INSTRUMENT CMake
+// option). Otherwise every RT_COUNT* macro expands to nothing. Each thread counts into its own
+// thread_local block with plain increments and folds it into the shared totals under a lock only
+// when the thread exits.
+
+#ifdef RT_INSTRUMENT
+
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+
+
+struct render_counters {
+    static const int max_depth = 64;
+    static const int num_material_kinds = 4;   // one slot per material_kind
+
+    unsigned long long primary_rays = 0;
+    unsigned long long secondary_rays = 0;
+    unsigned long long primitive_tests = 0;
+    unsigned long long material_hits[num_material_kinds] = {0};
+    unsigned long long path_depth[max_depth+1] = {0};     // by rays traced; last slot collects longer paths
+    unsigned long long disk_rejection_iterations = 0;
+    unsigned long long sphere_rejection_iterations = 0;
+
+    void add(const render_counters& o) {
+        primary_rays += o.primary_rays;
+        secondary_rays += o.secondary_rays;
+        primitive_tests += o.primitive_tests;
+        for (int k = 0; k < num_material_kinds; k++) material_hits[k] += o.material_hits[k];
+        for (int d = 0; d <= max_depth; d++) path_depth[d] += o.path_depth[d];
+        disk_rejection_iterations += o.disk_rejection_iterations;
+        sphere_rejection_iterations += o.sphere_rejection_iterations;
+    }
+};
+
+
+struct tile_timing {
+    tile t;
+    double seconds;
+};
+
+
+struct instrument_totals {
+    std::mutex m;
+    render_counters counters;
+    std::vector<tile_timing> tiles;
+};
+
+inline instrument_totals& instrument_registry() {
+    static instrument_totals totals;
+    return totals;
+}
+
+
+struct thread_instrument {
+    render_counters counters;
+    std::vector<tile_timing> tiles;
+
+    void flush() {
+        instrument_totals& r = instrument_registry();
+        std::lock_guard<std::mutex> lock(r.m);
+        r.counters.add(counters);
+        r.tiles.insert(r.tiles.end(), tiles.begin(), tiles.end());
+        counters = render_counters();
+        tiles.clear();
+    }
+    ~thread_instrument() { flush(); }
+};
+
+inline thread_instrument& thread_instruments() {
+    thread_local thread_instrument t;
+    return t;
+}
+
+
+inline void record_path_depth(int depth) {
+    int d = depth < render_counters::max_depth ? depth : render_counters::max_depth;
+    thread_instruments().counters.path_depth[d]++;
+}
+
+
+// Records the time from construction to destruction as one render of tile t. Renderers that make
+// several passes record each tile once per pass.
+class scoped_tile_timer {
+    public:
+        explicit scoped_tile_timer(const tile& t) : t(t), start(std::chrono::steady_clock::now()) {}
+        ~scoped_tile_timer() {
+            tile_timing timing = { t, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+            thread_instruments().tiles.push_back(timing);
+        }
+    private:
+        tile t;
+        std::chrono::steady_clock::time_point start;
+};
+
+
+// Totals of every finished worker plus the calling thread. Call once the render's workers joined.
+inline instrument_totals& collect_instrumentation() {
+    thread_instruments().flush();
+    return instrument_registry();
+}
+
+
+inline void reset_instrumentation() {
+    thread_instruments().flush();
+    instrument_totals& r = instrument_registry();
+    std::lock_guard<std::mutex> lock(r.m);
+    r.counters = render_counters();
+    r.tiles.clear();
+}
+
+
+bool write_instrumentation_json(const char *path, instrument_totals& totals) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    const render_counters& c = totals.counters;
+    static const char *kinds[render_counters::num_material_kinds] = { "lambertian", "metal", "dielectric", "other" };
+    fprintf(f, "{\n  \"primary_rays\": %llu,\n  \"secondary_rays\": %llu,\n  \"primitive_tests\": %llu,\n",
+            c.primary_rays, c.secondary_rays, c.primitive_tests);
+    fprintf(f, "  \"material_hits\": {");
+    for (int k = 0; k < render_counters::num_material_kinds; k++)
+        fprintf(f, "%s\"%s\": %llu", k ? ", " : "", kinds[k], c.material_hits[k]);
+    fprintf(f, "},\n  \"path_depth_histogram\": [");
+    for (int d = 0; d <= render_counters::max_depth; d++)
+        fprintf(f, "%s%llu", d ? ", " : "", c.path_depth[d]);
+    fprintf(f, "],\n  \"disk_rejection_iterations\": %llu,\n  \"sphere_rejection_iterations\": %llu,\n",
+            c.disk_rejection_iterations, c.sphere_rejection_iterations);
+    fprintf(f, "  \"tiles\": [");
+    for (size_t k = 0; k < totals.tiles.size(); k++) {
+        const tile_timing& t = totals.tiles[k];
+        fprintf(f, "%s\n    {\"x0\": %d, \"y0\": %d, \"x1\": %d, \"y1\": %d, \"seconds\": %.9f}",
+                k ? "," : "", t.t.x0, t.t.y0, t.t.x1, t.t.y1, t.seconds);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+
+// Each pixel's render time on a blue (fastest) to red (slowest) ramp: every timing is spread
+// evenly over its tile's pixels and summed, so multi-pass renders and passes with differently
+// sized tiles add up to the time each pixel took overall.
+framebuffer tile_heatmap(const std::vector<tile_timing>& tiles, int nx, int ny) {
+    std::vector<double> seconds(size_t(nx) * ny, 0.0);
+    for (const tile_timing& t : tiles) {
+        int area = (t.t.x1 - t.t.x0) * (t.t.y1 - t.t.y0);
+        if (area <= 0) continue;
+        for (int j = t.t.y0; j < t.t.y1 && j < ny; j++)
+            for (int i = t.t.x0; i < t.t.x1 && i < nx; i++)
+                seconds[size_t(j)*nx + i] += t.seconds / area;
+    }
+    double lo = 0, hi = 0;
+    for (size_t p = 0; p < seconds.size(); p++) {
+        if (p == 0 || seconds[p] < lo) lo = seconds[p];
+        if (p == 0 || seconds[p] > hi) hi = seconds[p];
+    }
+    framebuffer img(nx, ny);
+    for (size_t p = 0; p < seconds.size(); p++) {
+        float x = hi > lo ? float((seconds[p] - lo) / (hi - lo)) : 0.0f;
+        vec3 c(x, 0.2f, 1 - x);
+        img.pixels[p] = c*c;    // undo the gamma applied on output
+    }
+    return img;
+}
+
+
+#define RT_COUNT(field) (thread_instruments().counters.field++)
+#define RT_COUNT_N(field, n) (thread_instruments().counters.field += (n))
+#define RT_COUNT_DEPTH(depth) record_path_depth(depth)
+#define RT_TIME_TILE(t) scoped_tile_timer rt_tile_timer(t)
+
+#else
+
+#define RT_COUNT(field) ((void)0)
+#define RT_COUNT_N(field, n) ((void)0)
+#define RT_COUNT_DEPTH(depth) ((void)0)
+#define RT_TIME_TILE(t) ((void)0)
+
+#endif
+
+
+#endif
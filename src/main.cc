@@ -9,106 +9,483 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
 #include "sphere.h"
 #include "hitable_list.h"
-#include "float.h"
+#include "bvh.h"
+#include "sphere_set.h"
 #include "camera.h"
 #include "material.h"
 #include "random.h"
+#include "sampler.h"
+#include "render.h"
+#include "wavefront.h"
+#include "adaptive.h"
+#include "progressive.h"
+#include "scene.h"
+#include "closed_dispatch.h"
+#include "compact_scene.h"
+#include "mesh.h"
+#include "distributed.h"
+#include "denoise.h"
+#include "batch.h"
+#include "preview.h"
+#include "incremental.h"
+#include "packet.h"
 
 
-vec3 color(const ray& r, hitable *world, int depth) {
-    hit_record rec;
-    if (world->hit(r, 0.001, MAXFLOAT, rec)) {
-        ray scattered;
-        vec3 attenuation;
-        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-             return attenuation*color(scattered, world, depth+1);
+// Builds the requested acceleration structure over the scene: "list", "bvh", "spheres" or
+// "compact". The compact set makes its own material palette and does not use mats.
+hitable *make_world(const scene_description& scene, const std::vector<material*>& mats, const char *accel,
+                    arena& mem) {
+    if (!strcmp(accel, "compact"))
+        return make_compact_sphere_set(scene, mem);
+    if (!strcmp(accel, "spheres"))
+        return make_sphere_set(scene, mats);
+    hitable_list *list = make_hitable_list(scene, mats, mem);
+    if (!strcmp(accel, "list"))
+        return list;
+    return new bvh(list->list, list->list_size);
+}
+
+
+int main(int argc, char **argv) {
+    int nx = 1200;
+    int ny = 800;
+    render_settings settings;
+    const char *accel = "spheres";
+    const char *integrator = "recursive";
+    const char *output = 0;
+    image_format format = image_p6;
+    sampler_type sampling = sampler_random;
+    bool adaptive = false;
+    adaptive_settings adaptive_opts;
+    const char *spp_output = 0;
+    progressive_settings prog;
+    const char *scene_path = 0;
+    const char *export_text = 0;
+    const char *export_binary = 0;
+    bool print_stats = false;
+    bool denoise_image = false;
+    const char *aux_prefix = 0;
+    const char *camera_file = 0;
+    int frames = 0;
+    double preview_ms = 0;
+    const char *preview_frames = 0;
+    const char *edit_file = 0;
+    const char *instrument_prefix = 0;
+    const char *connect_address = 0;
+    int listen_port = -1;
+    int spawn_workers = 0;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-w") && a+1 < argc && (nx = atoi(argv[a+1])) > 0)
+            a++;
+        else if (!strcmp(argv[a], "-h") && a+1 < argc && (ny = atoi(argv[a+1])) > 0)
+            a++;
+        else if (!strcmp(argv[a], "-t") && a+1 < argc && (settings.threads = atoi(argv[a+1])) > 0)
+            a++;
+        else if (!strcmp(argv[a], "-a") && a+1 < argc)
+            accel = argv[++a];
+        else if (!strcmp(argv[a], "-tile") && a+1 < argc && (settings.tile_size = atoi(argv[a+1])) > 0)
+            a++;
+        else if (!strcmp(argv[a], "-i") && a+1 < argc)
+            integrator = argv[++a];
+        else if (!strcmp(argv[a], "-s") && a+1 < argc)
+            settings.ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-sampler") && a+1 < argc && parse_sampler_type(argv[a+1], sampling))
+            a++;
+        else if (!strcmp(argv[a], "-adaptive") && a+1 < argc) {
+            adaptive = true;
+            adaptive_opts.threshold = atof(argv[++a]);
         }
-        else {
-            return vec3(0,0,0);
+        else if (!strcmp(argv[a], "-maxspp") && a+1 < argc)
+            adaptive_opts.max_samples = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-spp-image") && a+1 < argc)
+            spp_output = argv[++a];
+        else if (!strcmp(argv[a], "-checkpoint") && a+1 < argc)
+            prog.checkpoint = argv[++a];
+        else if (!strcmp(argv[a], "-checkpoint-every") && a+1 < argc)
+            prog.checkpoint_seconds = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-pass") && a+1 < argc)
+            prog.samples_per_pass = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-scene") && a+1 < argc)
+            scene_path = argv[++a];
+        else if (!strcmp(argv[a], "-export-text") && a+1 < argc)
+            export_text = argv[++a];
+        else if (!strcmp(argv[a], "-export-binary") && a+1 < argc)
+            export_binary = argv[++a];
+        else if (!strcmp(argv[a], "-rr"))
+            settings.paths.russian_roulette = true;
+        else if (!strcmp(argv[a], "-rr-min") && a+1 < argc)
+            settings.paths.min_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-maxdepth") && a+1 < argc)
+            settings.paths.max_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-denoise"))
+            denoise_image = true;
+        else if (!strcmp(argv[a], "-aux") && a+1 < argc)
+            aux_prefix = argv[++a];
+        else if (!strcmp(argv[a], "-cameras") && a+1 < argc)
+            camera_file = argv[++a];
+        else if (!strcmp(argv[a], "-frames") && a+1 < argc)
+            frames = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-preview") && a+1 < argc)
+            preview_ms = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-preview-frames") && a+1 < argc)
+            preview_frames = argv[++a];
+        else if (!strcmp(argv[a], "-edits") && a+1 < argc)
+            edit_file = argv[++a];
+        else if (!strcmp(argv[a], "-stats"))
+            print_stats = true;
+        else if (!strcmp(argv[a], "-instrument") && a+1 < argc)
+            instrument_prefix = argv[++a];
+        else if (!strcmp(argv[a], "-connect") && a+1 < argc)
+            connect_address = argv[++a];
+        else if (!strcmp(argv[a], "-listen") && a+1 < argc)
+            listen_port = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-spawn") && a+1 < argc)
+            spawn_workers = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-o") && a+1 < argc)
+            output = argv[++a];
+        else if (!(!strcmp(argv[a], "-f") && a+1 < argc && parse_image_format(argv[++a], format))) {
+            std::cerr << "usage: " << argv[0] << " [-w width] [-h height] [-t threads] [-s samples] [-a list|bvh|spheres|compact]\n"
+                      << "       [-i recursive|packet|wavefront|closed] [-tile size]\n"
+                      << "       [-sampler random|halton|sobol|bluenoise]\n"
+                      << "       [-f p3|p6|pfm|raw] [-o file]\n"
+                      << "       [-adaptive threshold] [-maxspp n] [-spp-image file]\n"
+                      << "       [-checkpoint file] [-checkpoint-every seconds] [-pass samples]\n"
+                      << "       [-scene file] [-export-text file] [-export-binary file]\n"
+                      << "       [-rr] [-rr-min depth] [-maxdepth depth] [-stats]\n"
+                      << "       [-denoise] [-aux prefix]\n"
+                      << "       [-cameras file] [-frames n]\n"
+                      << "       [-preview milliseconds] [-preview-frames file] [-edits file]\n"
+                      << "       [-instrument prefix]\n"
+                      << "       [-listen port] [-spawn workers] [-connect host:port]\n";
+            return 1;
         }
     }
-    else {
-        vec3 unit_direction = unit_vector(r.direction());
-        float t = 0.5*(unit_direction.y() + 1.0);
-        return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+    settings.sampling = get_sampler(sampling);
+    scene_description scene;
+    std::string error;
+    if (!scene_path)
+        random_scene(scene);
+    else if (!read_scene(scene_path, scene, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    if ((export_text && !write_scene_text(export_text, scene))
+        || (export_binary && !write_scene_binary(export_binary, scene))) {
+        std::cerr << "could not export scene\n";
+        return 1;
     }
-}
 
+#ifndef RT_INSTRUMENT
+    if (instrument_prefix) {
+        std::cerr << "-instrument needs a build with RTWEEKEND_INSTRUMENT on\n";
+        return 1;
+    }
+#endif
+    // Counters and tile timings describe one image rendered in this process; frame sequences
+    // and remote workers would mix several images' tiles or count elsewhere.
+    if (instrument_prefix && (camera_file || frames > 0 || edit_file || connect_address
+                              || listen_port >= 0 || spawn_workers > 0)) {
+        std::cerr << "-instrument records single-image local renders; not with -cameras, -frames, -edits, "
+                     "-connect, -listen or -spawn\n";
+        return 1;
+    }
+#ifdef DISTRIBUTED_AVAILABLE
+    if (connect_address)
+        return run_worker(connect_address, settings.threads) ? 0 : 1;
+#else
+    if (connect_address || listen_port >= 0 || spawn_workers > 0) {
+        std::cerr << "distributed rendering is not available on this platform\n";
+        return 1;
+    }
+#endif
 
-hitable *random_scene() {
-    int n = 500;
-    hitable **list = new hitable*[n+1];
-    list[0] =  new sphere(vec3(0,-1000,0), 1000, new lambertian(vec3(0.5, 0.5, 0.5)));
-    int i = 1;
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            float choose_mat = random_double();
-            vec3 center(a+0.9*random_double(),0.2,b+0.9*random_double());
-            if ((center-vec3(4,0.2,0)).length() > 0.9) {
-                if (choose_mat < 0.8) {  // diffuse
-                    list[i++] = new sphere(
-                        center, 0.2,
-                        new lambertian(vec3(random_double()*random_double(),
-                                            random_double()*random_double(),
-                                            random_double()*random_double()))
-                    );
-                }
-                else if (choose_mat < 0.95) { // metal
-                    list[i++] = new sphere(
-                        center, 0.2,
-                        new metal(vec3(0.5*(1 + random_double()),
-                                       0.5*(1 + random_double()),
-                                       0.5*(1 + random_double())),
-                                  0.5*random_double())
-                    );
-                }
-                else {  // glass
-                    list[i++] = new sphere(center, 0.2, new dielectric(1.5));
-                }
-            }
+    arena scene_memory;
+    std::vector<material*> mats;
+    if (strcmp(accel, "compact") || !strcmp(integrator, "closed") || !scene.instances.empty())
+        mats = make_materials(scene, scene_memory);
+    hitable *world = make_world(scene, mats, accel, scene_memory);
+    std::vector<triangle_mesh*> meshes;
+    if (!scene.instances.empty()) {
+        if (!strcmp(integrator, "closed")) {
+            std::cerr << "the closed integrator renders spheres only\n";
+            return 1;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        hitable *placed = make_mesh_instances(scene, mats, scene_memory, meshes, settings.threads, error);
+        if (!placed) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        hitable **both = scene_memory.create_array<hitable*>(2);
+        both[0] = world;
+        both[1] = placed;
+        world = scene_memory.create<hitable_list>(both, 2);
+        if (print_stats) {
+            long long triangles = 0;
+            for (const triangle_mesh *m : meshes) triangles += m->num_triangles();
+            std::cerr << meshes.size() << " meshes, " << triangles << " triangles, " << scene.instances.size()
+                      << " instances, loaded in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
         }
     }
+    if (print_stats) {
+        if (compact_sphere_set *compact = dynamic_cast<compact_sphere_set*>(world)) {
+            std::cerr << "compact scene: " << compact->size() << " spheres, " << compact->palette.size()
+                      << " palette materials, " << double(compact->bytes()) / ffmax(1, compact->size())
+                      << " bytes per sphere beside the scene's table\n";
+        }
+    }
+    camera cam = scene.make_camera(float(nx)/float(ny));
 
-    list[i++] = new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5));
-    list[i++] = new sphere(vec3(-4, 1, 0), 1.0, new lambertian(vec3(0.4, 0.2, 0.1)));
-    list[i++] = new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0));
-
-    return new hitable_list(list,i);
-}
-
+    // Batch mode: one scene, many cameras. A camera file gives one frame per record, or -frames
+    // evenly spaced samples along it; -frames alone orbits the scene's camera around its target.
+    if (camera_file || frames > 0) {
+        std::vector<scene_camera> views;
+        if (camera_file) {
+            camera_path path;
+            if (!read_camera_path(camera_file, path, error)) {
+                std::cerr << error << "\n";
+                return 1;
+            }
+            if (frames > 0)
+                views = sample_path(path, frames);
+            else
+                for (const camera_key& k : path.keys) views.push_back(k.cam);
+        }
+        else {
+            views = turntable(scene.cam, frames);
+        }
+        std::vector<camera> cams;
+        for (const scene_camera& v : views)
+            cams.push_back(make_camera(v, real(nx)/real(ny)));
 
-int main() {
-    int nx = 1200;
-    int ny = 800;
-    int ns = 10;
-    std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-    hitable *world = random_scene();
+        std::string pattern = output ? output : std::string("frame%04d.") + (format == image_pfm ? "pfm" : format == image_raw ? "raw" : "ppm");
+        sphere_set *set = 0;
+        std::unique_ptr<sphere_set> owned_set;     // when the world is not already a sphere_set
+        std::vector<material_variant> variants;
+        if (!strcmp(integrator, "closed")) {
+            set = dynamic_cast<sphere_set*>(world);
+            if (!set) {
+                owned_set.reset(make_sphere_set(scene, mats));
+                set = owned_set.get();
+            }
+            variants = make_material_variants(scene);
+        }
+        path_stats stats;
+        auto render_frame = [&](const camera& c, int k, framebuffer& frame) {
+            render_settings s = settings;
+            s.frame = settings.frame + k;
+            if (!strcmp(integrator, "wavefront"))
+                stats.add(render_wavefront(c, world, s, frame));
+            else if (set)
+                stats.add(render_closed(c, *set, variants, s, frame));
+            else if (!strcmp(integrator, "packet"))
+                stats.add(render_packets(c, world, s, frame));
+            else
+                stats.add(render(c, world, s, frame));
+        };
+        auto write_frame = [&](int k, const framebuffer& frame) {
+            std::string name = frame_path(pattern, k);
+            if (write_image(name.c_str(), frame, format)) return true;
+            std::cerr << "could not write image to " << name << "\n";
+            return false;
+        };
+        batch_stats batch;
+        bool ok = render_batch(cams, nx, ny, render_frame, write_frame, &batch);
+        if (print_stats) {
+            std::cerr << batch.frames << " frames, " << batch.render_seconds << " s tracing, "
+                      << batch.wall_seconds << " s total, "
+                      << 1e3*(batch.wall_seconds - batch.render_seconds) / (batch.frames > 0 ? batch.frames : 1)
+                      << " ms per frame outside tracing\n";
+        }
+        return ok ? 0 : 1;
+    }
 
-    vec3 lookfrom(13,2,3);
-    vec3 lookat(0,0,0);
-    float dist_to_focus = 10.0;
-    float aperture = 0.1;
+    // Edit mode: the scene, then one frame per batch of edits, each re-tracing only the tiles the
+    // batch could have changed.
+    if (edit_file) {
+        std::vector<scene_edit> edits;
+        if (!read_scene_edits(edit_file, edits, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        if (!scene.instances.empty() || strcmp(integrator, "recursive")) {
+            std::cerr << "-edits renders sphere scenes with the recursive integrator\n";
+            return 1;
+        }
+        if (mats.empty()) mats = make_materials(scene, scene_memory);
+        std::string pattern = output ? output : std::string("edit%04d.") + (format == image_pfm ? "pfm" : format == image_raw ? "raw" : "ppm");
+        incremental_renderer inc(scene, mats, cam, settings, nx, ny);
+        framebuffer frame(nx, ny);
+        int k = 0;
+        size_t e = 0;
+        for (;;) {
+            incremental_stats st = inc.render(frame);
+            std::string name = frame_path(pattern, k);
+            if (!write_image(name.c_str(), frame, format)) {
+                std::cerr << "could not write image to " << name << "\n";
+                return 1;
+            }
+            if (print_stats) {
+                std::cerr << "frame " << k << ": " << st.traced << " of " << st.tiles << " tiles traced, "
+                          << st.paths.rays << " rays, " << 1e3*st.seconds << " ms"
+                          << (st.rebuilt ? ", tree rebuilt" : "") << "\n";
+            }
+            size_t batch = e;
+            for (; e < edits.size() && edits[e].kind != edit_render; e++) {
+                if (!inc.apply(edits[e], scene_memory)) {
+                    std::cerr << edit_file << ": edit " << e+1 << " names a sphere or material that does not exist\n";
+                    return 1;
+                }
+            }
+            if (e == edits.size() && e == batch) break;
+            if (e < edits.size()) e++;
+            k++;
+        }
+        return 0;
+    }
 
-    camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny), aperture, dist_to_focus);
+    framebuffer fb(nx, ny);
+    std::vector<int> counts;
+#ifdef DISTRIBUTED_AVAILABLE
+    if (listen_port >= 0 || spawn_workers > 0) {
+        if (!scene.meshes.empty()) {
+            std::cerr << "distributed rendering sends the binary scene, which has no meshes\n";
+            return 1;
+        }
+        int port = listen_port > 0 ? listen_port : 0;
+        // without -listen the only workers are the ones spawned here, so stay off the network
+        int listen_fd = listen_on(port, listen_port < 0);
+        if (listen_fd < 0) {
+            std::cerr << "cannot listen on port " << port << "\n";
+            return 1;
+        }
+        std::cerr << "coordinator listening on port " << port << "\n";
+        std::vector<pid_t> local = spawn_local_workers(spawn_workers, port, settings.threads);
+        coordinator_settings coord;
+        coord.sampling = sampling;
+        bool ok = run_coordinator(listen_fd, scene, settings, coord, fb);
+        close(listen_fd);
+        wait_for_workers(local);
+        if (!ok) {
+            std::cerr << "distributed render failed\n";
+            return 1;
+        }
+    }
+    else
+#endif
+    if (prog.checkpoint) {
+        progressive_state st(nx, ny, settings.frame);
+        st.sampling = sampling;
+        st.paths = settings.paths;
+        st.scene = scene_hash(scene);
+        if (load_checkpoint(prog.checkpoint, st, error))
+            std::cerr << "resuming from " << st.samples_done << " samples per pixel\n";
+        else if (!error.empty()) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        if (!render_progressive(cam, world, settings, prog, st, fb)) {
+            std::cerr << "could not write checkpoint " << prog.checkpoint << "\n";
+            return 1;
+        }
+    }
+    else if (preview_ms > 0) {
+        preview_settings preview_opts;
+        preview_opts.budget_seconds = preview_ms / 1000;
+        bool frames_ok = true;
+        preview_step last = render_preview(cam, world, settings, preview_opts, fb,
+                                           [&](const framebuffer& step_fb, const preview_step& step) {
+            if (!preview_frames) return;
+            std::string name = frame_path(preview_frames, step.index);
+            frames_ok = write_image(name.c_str(), step_fb, format) && frames_ok;
+        });
+        if (!frames_ok) {
+            std::cerr << "could not write preview frames to " << preview_frames << "\n";
+            return 1;
+        }
+        if (print_stats) {
+            std::cerr << "preview: " << last.index+1 << " steps in " << 1e3*last.seconds << " ms, "
+                      << (last.stride > 1 ? std::to_string(last.stride) + "x" + std::to_string(last.stride) + " blocks"
+                                          : std::to_string(last.last_sample) + " spp")
+                      << ", depth " << last.max_depth << (last.complete ? "" : ", last step cut short") << "\n";
+        }
+    }
+    else if (adaptive)
+        render_adaptive(cam, world, settings, adaptive_opts, fb, &counts);
+    else {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        path_stats stats;
+        if (!strcmp(integrator, "wavefront"))
+            stats = render_wavefront(cam, world, settings, fb);
+        else if (!strcmp(integrator, "closed")) {
+            std::unique_ptr<sphere_set> owned_set;
+            sphere_set *set = dynamic_cast<sphere_set*>(world);
+            if (!set) {
+                owned_set.reset(make_sphere_set(scene, mats));
+                set = owned_set.get();
+            }
+            stats = render_closed(cam, *set, make_material_variants(scene), settings, fb);
+        }
+        else if (!strcmp(integrator, "packet"))
+            stats = render_packets(cam, world, settings, fb);
+        else
+            stats = render(cam, world, settings, fb);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (print_stats) {
+            // -s 0 traces no paths
+            std::cerr << "paths " << stats.paths << ", rays " << stats.rays
+                      << ", average path length " << (stats.paths ? double(stats.rays) / double(stats.paths) : 0.0)
+                      << ", " << (seconds > 0 ? stats.rays / seconds / 1e6 : 0.0) << " Mrays/s\n";
+        }
+    }
 
-    for (int j = ny-1; j >= 0; j--) {
-        for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
-            for (int s=0; s < ns; s++) {
-                float u = float(i + random_double()) / float(nx);
-                float v = float(j + random_double()) / float(ny);
-                ray r = cam.get_ray(u, v);
-                col += color(r, world,0);
+    if (denoise_image || aux_prefix) {
+        denoise_settings denoise_opts;
+        aux_buffers aux(nx, ny);
+        render_aux(cam, world, settings, denoise_opts.aux_samples, aux);
+        if (denoise_image) {
+            framebuffer noisy(fb);
+            denoise(noisy, aux, denoise_opts, settings.threads, fb);
+        }
+        const char *names[3] = { "-albedo", "-normal", "-depth" };
+        for (int c = 0; aux_prefix && c < 3; c++) {
+            std::string path = std::string(aux_prefix) + names[c] + ".pfm";
+            if (!write_image(path.c_str(), aux_image(aux, aux_channel(c)), image_pfm)) {
+                std::cerr << "could not write " << path << "\n";
+                return 1;
             }
-            col /= float(ns);
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
-            int ir = int(255.99*col[0]);
-            int ig = int(255.99*col[1]);
-            int ib = int(255.99*col[2]);
-            std::cout << ir << " " << ig << " " << ib << "\n";
+        }
+    }
+
+    if (!write_image(output, fb, format)) {
+        std::cerr << "could not write image to " << (output ? output : "stdout") << "\n";
+        return 1;
+    }
+#ifdef RT_INSTRUMENT
+    if (instrument_prefix) {
+        instrument_totals& totals = collect_instrumentation();
+        std::string json = std::string(instrument_prefix) + ".json";
+        std::string heatmap = std::string(instrument_prefix) + "-tiles.ppm";
+        if (!write_instrumentation_json(json.c_str(), totals)
+            || !write_image(heatmap.c_str(), tile_heatmap(totals.tiles, nx, ny), image_p6)) {
+            std::cerr << "could not write instrumentation to " << instrument_prefix << "\n";
+            return 1;
+        }
+    }
+#endif
+    if (adaptive && spp_output) {
+        framebuffer spp = sample_count_image(counts, nx, ny, adaptive_opts.max_samples);
+        if (!write_image(spp_output, spp, format)) {
+            std::cerr << "could not write sample counts to " << spp_output << "\n";
+            return 1;
         }
     }
 }
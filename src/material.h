@@ -14,21 +14,23 @@
 #include "ray.h"
 #include "hitable.h"
 #include "random.h"
+#include "sampler.h"
+#include "instrument.h"
 
 struct hit_record;
 
 
-float schlick(float cosine, float ref_idx) {
-    float r0 = (1-ref_idx) / (1+ref_idx);
+real schlick(real cosine, real ref_idx) {
+    real r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1 - cosine),5);
 }
 
 
-bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
+bool refract(const vec3& v, const vec3& n, real ni_over_nt, vec3& refracted) {
     vec3 uv = unit_vector(v);
-    float dt = dot(uv, n);
-    float discriminant = 1.0 - ni_over_nt*ni_over_nt*(1-dt*dt);
+    real dt = dot(uv, n);
+    real discriminant = 1.0 - ni_over_nt*ni_over_nt*(1-dt*dt);
     if (discriminant > 0) {
         refracted = ni_over_nt*(uv - n*dt) - n*sqrt(discriminant);
         return true;
@@ -43,18 +45,32 @@ vec3 reflect(const vec3& v, const vec3& n) {
 }
 
 
+// Like random_in_unit_disk(), mapped from two sampler pairs when a sampler is active.
 vec3 random_in_unit_sphere() {
+    if (sampling_enabled()) {
+        double u[2];
+        sample_2d(u);
+        return uniform_ball(u[0], u[1], sample_1d());
+    }
     vec3 p;
     do {
+        RT_COUNT(sphere_rejection_iterations);
         p = 2.0*vec3(random_double(),random_double(),random_double()) - vec3(1,1,1);
     } while (p.squared_length() >= 1.0);
     return p;
 }
 
 
+// Lets batch integrators bucket hits by concrete material and call scatter() without dispatch.
+enum material_kind { material_lambertian, material_metal, material_dielectric, material_other };
+
+
 class material  {
     public:
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
+        virtual material_kind kind() const { return material_other; }
+        // Overall surface color, recorded as the albedo guide for denoising.
+        virtual vec3 reflectance() const { return vec3(1,1,1); }
 };
 
 
@@ -67,6 +83,8 @@ class lambertian : public material {
              attenuation = albedo;
              return true;
         }
+        virtual material_kind kind() const { return material_lambertian; }
+        virtual vec3 reflectance() const { return albedo; }
 
         vec3 albedo;
 };
@@ -74,29 +92,31 @@ class lambertian : public material {
 
 class metal : public material {
     public:
-        metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
+        metal(const vec3& a, real f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
             scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
+        virtual material_kind kind() const { return material_metal; }
+        virtual vec3 reflectance() const { return albedo; }
         vec3 albedo;
-        float fuzz;
+        real fuzz;
 };
 
 
 class dielectric : public material {
     public:
-        dielectric(float ri) : ref_idx(ri) {}
+        dielectric(real ri) : ref_idx(ri) {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
              vec3 outward_normal;
              vec3 reflected = reflect(r_in.direction(), rec.normal);
-             float ni_over_nt;
+             real ni_over_nt;
              attenuation = vec3(1.0, 1.0, 1.0);
              vec3 refracted;
-             float reflect_prob;
-             float cosine;
+             real reflect_prob;
+             real cosine;
              if (dot(r_in.direction(), rec.normal) > 0) {
                   outward_normal = -rec.normal;
                   ni_over_nt = ref_idx;
@@ -119,8 +139,9 @@ class dielectric : public material {
                 scattered = ray(rec.p, refracted);
              return true;
         }
+        virtual material_kind kind() const { return material_dielectric; }
 
-        float ref_idx;
+        real ref_idx;
 };
 
 
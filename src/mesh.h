@@ -0,0 +1,617 @@
+#ifndef MESHH
+#define MESHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "aligned_allocator.h"
+#include "bvh.h"
+#include "hitable.h"
+#include "instrument.h"
+#include "scene.h"
+#include "tile_scheduler.h"
+
+// Same conditions as sphere_set's kernels: the vector path is single precision.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(RT_DOUBLE_PRECISION)
+#define MESH_X86 1
+#include <immintrin.h>
+#endif
+
+
+// The per-ray part of the watertight test (Woop, Benthin and Wald 2013): the axis the ray
+// travels along most becomes z, and a shear maps the direction onto it, so each triangle is
+// tested in 2D with edge functions that agree exactly along shared edges.
+struct ray_shear {
+    ray_shear(const vec3& d) {
+        kz = 0;
+        if (fabs(d.y()) > fabs(d[kz])) kz = 1;
+        if (fabs(d.z()) > fabs(d[kz])) kz = 2;
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        // keeps the winding, and so the sign of the edge functions, the same for every ray
+        if (d[kz] < 0) { int k = kx; kx = ky; ky = k; }
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1 / d[kz];
+    }
+
+    int kx, ky, kz;
+    real sx, sy, sz;
+};
+
+
+// An indexed triangle mesh with its own BVH. Vertices are shared between triangles: an OBJ
+// corner becomes one vertex per distinct position/normal pair. Normals follow the winding
+// (counterclockwise seen from outside), like sphere's outward normal, so dielectric meshes know
+// inside from outside; per-vertex normals, when present, are interpolated for shading. build()
+// orders the triangles by BVH leaf and copies their corners into structure-of-arrays form for the
+// intersection kernels, which test a whole leaf per call.
+class triangle_mesh : public hitable {
+    public:
+        static const int simd_width = 8;
+        static const int leaf_size = 8;
+
+        triangle_mesh() {}
+        void build();
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        // Tests triangles [first, first+count) and returns the index of the nearest hit in
+        // (t_min, closest), lowering closest to it, or -1 if there is none.
+        int hit_range(const ray& r, const ray_shear& sh, int first, int count, real t_min, real& closest) const;
+        int hit_range_scalar(const ray& r, const ray_shear& sh, int first, int count, real t_min, real& closest) const;
+        bool hit_triangle(const ray& r, const ray_shear& sh, int i, real t_min, real& closest) const;
+#ifdef MESH_X86
+        __attribute__((target("avx2")))
+        int hit_range_avx2(const ray& r, const ray_shear& sh, int first, int count, real t_min, real& closest) const;
+#endif
+
+        int num_triangles() const { return int(indices.size() / 3); }
+
+        std::vector<vec3> positions;
+        std::vector<vec3> normals;          // one per position, or empty for flat shading
+        std::vector<uint32_t> indices;      // three per triangle
+        material *mat_ptr = 0;
+
+        aligned_vector<float> corner[3][3]; // [vertex][axis][triangle] in leaf order, padded with simd_width zeros
+        bvh_tree tree;
+        bool use_avx2 = false;
+};
+
+
+void triangle_mesh::build() {
+    int n = num_triangles();
+    std::vector<aabb> boxes(n);
+    for (int i = 0; i < n; i++) {
+        const vec3& a = positions[indices[3*i]];
+        const vec3& b = positions[indices[3*i+1]];
+        const vec3& c = positions[indices[3*i+2]];
+        boxes[i] = aabb(vec3(ffmin(a.x(), ffmin(b.x(), c.x())), ffmin(a.y(), ffmin(b.y(), c.y())), ffmin(a.z(), ffmin(b.z(), c.z()))),
+                        vec3(ffmax(a.x(), ffmax(b.x(), c.x())), ffmax(a.y(), ffmax(b.y(), c.y())), ffmax(a.z(), ffmax(b.z(), c.z()))));
+    }
+    tree.build(boxes, leaf_size);
+
+    std::vector<uint32_t> sorted(indices.size());
+    for (int v = 0; v < 3; v++)
+        for (int a = 0; a < 3; a++)
+            corner[v][a].assign(n + simd_width, 0.0f);
+    for (int i = 0; i < n; i++) {
+        int p = tree.order[i];
+        for (int v = 0; v < 3; v++) {
+            sorted[3*i+v] = indices[3*p+v];
+            const vec3& x = positions[indices[3*p+v]];
+            for (int a = 0; a < 3; a++)
+                corner[v][a][i] = float(x[a]);
+        }
+        tree.order[i] = i;
+    }
+    indices.swap(sorted);
+
+#ifdef MESH_X86
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+// The watertight test on triangle i. Edge functions that come out exactly zero are redone in
+// double, as the paper does, so rays through an edge or vertex still hit exactly one side.
+inline bool triangle_mesh::hit_triangle(const ray& r, const ray_shear& sh, int i, real t_min, real& closest) const {
+    const vec3& o = r.origin();
+    real ax = corner[0][sh.kx][i] - o[sh.kx], ay = corner[0][sh.ky][i] - o[sh.ky], az = corner[0][sh.kz][i] - o[sh.kz];
+    real bx = corner[1][sh.kx][i] - o[sh.kx], by = corner[1][sh.ky][i] - o[sh.ky], bz = corner[1][sh.kz][i] - o[sh.kz];
+    real cx = corner[2][sh.kx][i] - o[sh.kx], cy = corner[2][sh.ky][i] - o[sh.ky], cz = corner[2][sh.kz][i] - o[sh.kz];
+    real Ax = ax - sh.sx*az, Ay = ay - sh.sy*az;
+    real Bx = bx - sh.sx*bz, By = by - sh.sy*bz;
+    real Cx = cx - sh.sx*cz, Cy = cy - sh.sy*cz;
+    real U = Cx*By - Cy*Bx;
+    real V = Ax*Cy - Ay*Cx;
+    real W = Bx*Ay - By*Ax;
+    if (U == 0 || V == 0 || W == 0) {
+        U = real(double(Cx)*double(By) - double(Cy)*double(Bx));
+        V = real(double(Ax)*double(Cy) - double(Ay)*double(Cx));
+        W = real(double(Bx)*double(Ay) - double(By)*double(Ax));
+    }
+    if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0)) return false;
+    real det = U + V + W;
+    if (det == 0) return false;
+    real T = U*(sh.sz*az) + V*(sh.sz*bz) + W*(sh.sz*cz);
+    real t = T / det;
+    if (t < closest && t > t_min) {
+        closest = t;
+        return true;
+    }
+    return false;
+}
+
+
+int triangle_mesh::hit_range(const ray& r, const ray_shear& sh, int first, int count, real t_min, real& closest) const {
+    RT_COUNT_N(primitive_tests, count);
+#ifdef MESH_X86
+    if (use_avx2)
+        return hit_range_avx2(r, sh, first, count, t_min, closest);
+#endif
+    return hit_range_scalar(r, sh, first, count, t_min, closest);
+}
+
+
+int triangle_mesh::hit_range_scalar(const ray& r, const ray_shear& sh, int first, int count, real t_min, real& closest) const {
+    int best = -1;
+    for (int i = first; i < first + count; i++)
+        if (hit_triangle(r, sh, i, t_min, closest))
+            best = i;
+    return best;
+}
+
+
+#ifdef MESH_X86
+
+// hit_triangle() on eight triangles at once, operation for operation. Lanes whose edge functions
+// hit zero are left to hit_triangle() for its double precision retry.
+__attribute__((target("avx2")))
+int triangle_mesh::hit_range_avx2(const ray& r, const ray_shear& sh, int first, int count, float t_min, float& closest) const {
+    const vec3& o = r.origin();
+    __m256 ox = _mm256_set1_ps(o[sh.kx]), oy = _mm256_set1_ps(o[sh.ky]), oz = _mm256_set1_ps(o[sh.kz]);
+    __m256 sx = _mm256_set1_ps(sh.sx), sy = _mm256_set1_ps(sh.sy), sz = _mm256_set1_ps(sh.sz);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 tmin = _mm256_set1_ps(t_min);
+    __m256 inf = _mm256_set1_ps(FLT_MAX);
+    __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const float *px[3], *py[3], *pz[3];
+    for (int v = 0; v < 3; v++) {
+        px[v] = &corner[v][sh.kx][0];
+        py[v] = &corner[v][sh.ky][0];
+        pz[v] = &corner[v][sh.kz][0];
+    }
+    int best = -1;
+    for (int i = first; i < first + count; i += 8) {
+        __m256 valid = _mm256_cmp_ps(lane, _mm256_set1_ps(float(first + count - i)), _CMP_LT_OQ);
+        __m256 az = _mm256_sub_ps(_mm256_loadu_ps(pz[0] + i), oz);
+        __m256 bz = _mm256_sub_ps(_mm256_loadu_ps(pz[1] + i), oz);
+        __m256 cz = _mm256_sub_ps(_mm256_loadu_ps(pz[2] + i), oz);
+        __m256 Ax = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(px[0] + i), ox), _mm256_mul_ps(sx, az));
+        __m256 Ay = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(py[0] + i), oy), _mm256_mul_ps(sy, az));
+        __m256 Bx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(px[1] + i), ox), _mm256_mul_ps(sx, bz));
+        __m256 By = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(py[1] + i), oy), _mm256_mul_ps(sy, bz));
+        __m256 Cx = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(px[2] + i), ox), _mm256_mul_ps(sx, cz));
+        __m256 Cy = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(py[2] + i), oy), _mm256_mul_ps(sy, cz));
+        __m256 U = _mm256_sub_ps(_mm256_mul_ps(Cx, By), _mm256_mul_ps(Cy, Bx));
+        __m256 V = _mm256_sub_ps(_mm256_mul_ps(Ax, Cy), _mm256_mul_ps(Ay, Cx));
+        __m256 W = _mm256_sub_ps(_mm256_mul_ps(Bx, Ay), _mm256_mul_ps(By, Ax));
+        __m256 on_edge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_EQ_OQ), _mm256_cmp_ps(V, zero, _CMP_EQ_OQ)),
+                                      _mm256_cmp_ps(W, zero, _CMP_EQ_OQ));
+        int retry = _mm256_movemask_ps(_mm256_and_ps(valid, on_edge));
+        valid = _mm256_andnot_ps(on_edge, valid);
+        __m256 any_neg = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_LT_OQ), _mm256_cmp_ps(V, zero, _CMP_LT_OQ)),
+                                      _mm256_cmp_ps(W, zero, _CMP_LT_OQ));
+        __m256 any_pos = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_GT_OQ), _mm256_cmp_ps(V, zero, _CMP_GT_OQ)),
+                                      _mm256_cmp_ps(W, zero, _CMP_GT_OQ));
+        valid = _mm256_andnot_ps(_mm256_and_ps(any_neg, any_pos), valid);
+        __m256 det = _mm256_add_ps(_mm256_add_ps(U, V), W);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+        if (_mm256_movemask_ps(valid)) {
+            __m256 T = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(U, _mm256_mul_ps(sz, az)),
+                                                   _mm256_mul_ps(V, _mm256_mul_ps(sz, bz))),
+                                     _mm256_mul_ps(W, _mm256_mul_ps(sz, cz)));
+            __m256 t = _mm256_div_ps(T, det);
+            __m256 ok = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(closest), _CMP_LT_OQ),
+                                                           _mm256_cmp_ps(t, tmin, _CMP_GT_OQ)));
+            int any = _mm256_movemask_ps(ok);
+            if (any) {
+                t = _mm256_blendv_ps(inf, t, ok);
+                __m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+                m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+                m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+                int lanes = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)) & any;
+                closest = _mm256_cvtss_f32(m);
+                best = i + __builtin_ctz(lanes);
+            }
+        }
+        while (retry) {
+            int k = __builtin_ctz(retry);
+            retry &= retry - 1;
+            if (hit_triangle(r, sh, i + k, t_min, closest))
+                best = i + k;
+        }
+    }
+    return best;
+}
+
+#endif
+
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    ray_shear sh(r.direction());
+    int best = -1;
+    real best_t = t_max;
+    tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest_so_far) {
+        int i = hit_range(r, sh, first, count, t_min, closest_so_far);
+        if (i < 0) return false;
+        best = i;
+        best_t = closest_so_far;
+        return true;
+    });
+    if (best < 0) return false;
+    const vec3& a = positions[indices[3*best]];
+    const vec3& b = positions[indices[3*best+1]];
+    const vec3& c = positions[indices[3*best+2]];
+    rec.t = best_t;
+    rec.p = r.point_at_parameter(rec.t);
+    if (normals.empty()) {
+        rec.normal = unit_vector(cross(b - a, c - a));
+    }
+    else {
+        // barycentrics of the hit point, from the sub-triangle areas
+        vec3 n = cross(b - a, c - a);
+        real inv = 1 / dot(n, n);
+        real wb = dot(cross(rec.p - a, c - a), n) * inv;
+        real wc = dot(cross(b - a, rec.p - a), n) * inv;
+        vec3 s = (1 - wb - wc)*normals[indices[3*best]] + wb*normals[indices[3*best+1]] + wc*normals[indices[3*best+2]];
+        real len = s.length();
+        rec.normal = len > 0 ? s / len : unit_vector(n);
+    }
+    rec.mat_ptr = mat_ptr;
+    return true;
+}
+
+
+bool triangle_mesh::bounding_box(aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.nodes[0].box;
+    return true;
+}
+
+
+// An affine map as the top three rows of a 4x4 matrix.
+struct transform {
+    real m[3][4];
+
+    static transform identity() {
+        transform t = {{ {1,0,0,0}, {0,1,0,0}, {0,0,1,0} }};
+        return t;
+    }
+    static transform translate(const vec3& d) {
+        transform t = identity();
+        t.m[0][3] = d.x(); t.m[1][3] = d.y(); t.m[2][3] = d.z();
+        return t;
+    }
+    static transform scale(real s) {
+        transform t = identity();
+        t.m[0][0] = t.m[1][1] = t.m[2][2] = s;
+        return t;
+    }
+    static transform rotate_y(real degrees) {
+        real a = degrees*M_PI/180, c = cos(a), s = sin(a);
+        transform t = identity();
+        t.m[0][0] = c;  t.m[0][2] = s;
+        t.m[2][0] = -s; t.m[2][2] = c;
+        return t;
+    }
+
+    vec3 point(const vec3& p) const {
+        return vec3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                    m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                    m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                    m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                    m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+    // Normals go by the inverse transpose; called on the inverse, this applies its transpose.
+    vec3 normal_from_inverse(const vec3& n) const {
+        return vec3(m[0][0]*n.x() + m[1][0]*n.y() + m[2][0]*n.z(),
+                    m[0][1]*n.x() + m[1][1]*n.y() + m[2][1]*n.z(),
+                    m[0][2]*n.x() + m[1][2]*n.y() + m[2][2]*n.z());
+    }
+
+    transform inverse() const {
+        real det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        real inv = 1 / det;
+        transform t;
+        t.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv;
+        t.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv;
+        t.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv;
+        t.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv;
+        t.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv;
+        t.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv;
+        t.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv;
+        t.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv;
+        t.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv;
+        for (int i = 0; i < 3; i++)
+            t.m[i][3] = -(t.m[i][0]*m[0][3] + t.m[i][1]*m[1][3] + t.m[i][2]*m[2][3]);
+        return t;
+    }
+};
+
+
+// a*b: b first, then a.
+inline transform operator*(const transform& a, const transform& b) {
+    transform t;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            t.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+            if (j == 3) t.m[i][j] += a.m[i][3];
+        }
+    }
+    return t;
+}
+
+
+// One placement of a shared object. The ray goes into object space unnormalized, so t means
+// the same on both sides and no hit needs rescaling. A material, when given, replaces the
+// object's own.
+class instance : public hitable {
+    public:
+        instance() {}
+        instance(const hitable *obj, const transform& to_world, material *m = 0)
+            : object(obj), world_from_object(to_world), object_from_world(to_world.inverse()), mat_ptr(m) {}
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const {
+            ray local(object_from_world.point(r.origin()), object_from_world.vector(r.direction()));
+            if (!object->hit(local, tmin, tmax, rec)) return false;
+            rec.p = r.point_at_parameter(rec.t);
+            rec.normal = unit_vector(object_from_world.normal_from_inverse(rec.normal));
+            if (mat_ptr) rec.mat_ptr = mat_ptr;
+            return true;
+        }
+        virtual bool bounding_box(aabb& box) const {
+            aabb local;
+            if (!object->bounding_box(local)) return false;
+            for (int k = 0; k < 8; k++) {
+                vec3 corner((k & 1) ? local.max().x() : local.min().x(),
+                            (k & 2) ? local.max().y() : local.min().y(),
+                            (k & 4) ? local.max().z() : local.min().z());
+                vec3 p = world_from_object.point(corner);
+                box = k ? surrounding_box(box, aabb(p, p)) : aabb(p, p);
+            }
+            return true;
+        }
+
+        const hitable *object;
+        transform world_from_object, object_from_world;
+        material *mat_ptr;
+};
+
+
+// Wavefront OBJ: v, vn and f records (polygons are fanned into triangles; negative indices count
+// back from the latest vertex; in a file with normals, corners without one get the face's normal);
+// everything else, texture coordinates included, is skipped. The file is read whole and cut into
+// chunks at line breaks that are parsed in parallel; only resolving indices and sharing vertices
+// runs on one thread. Calls build() when done.
+bool load_obj(const char *path, triangle_mesh& mesh, std::string& error, int threads = default_thread_count()) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { error = "cannot open " + std::string(path); return false; }
+    std::vector<char> text;
+    char buf[1 << 16];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.insert(text.end(), buf, buf + got);
+    fclose(f);
+    text.push_back('\n');
+    text.push_back('\0');
+
+    // A corner's position and normal indices. A negative OBJ index is kept relative to the first
+    // record of its chunk, since earlier chunks' counts are not known yet, and flagged local; it
+    // may still be negative when it reaches back into an earlier chunk.
+    struct obj_corner {
+        int64_t v, vn;
+        bool v_local, vn_local;
+        bool has_normal;
+    };
+    struct obj_chunk {
+        const char *begin, *end;
+        std::vector<vec3> v, vn;
+        std::vector<obj_corner> corners;
+        std::vector<int> face_sizes;
+        int bad_line = 0;       // offset of the first bad record + 1, 0 if none
+    };
+
+    if (threads < 1) threads = 1;
+    const size_t size = text.size() - 1;
+    int nchunks = int(size / (1 << 20)) + 1;
+    if (nchunks > 4*threads) nchunks = 4*threads;
+    std::vector<obj_chunk> chunks(nchunks);
+    const char *base = &text[0];
+    const char *pos = base;
+    for (int c = 0; c < nchunks; c++) {
+        const char *end = c == nchunks-1 ? base + size : base + size * (c+1) / nchunks;
+        if (end < pos) end = pos;
+        while (end < base + size && end[-1] != '\n') end++;
+        chunks[c].begin = pos;
+        chunks[c].end = end;
+        pos = end;
+    }
+
+    parallel_for_work_stealing(nchunks, threads, [&](int job, int) {
+        obj_chunk& ch = chunks[job];
+        const char *p = ch.begin;
+        while (p < ch.end) {
+            const char *line = p;
+            while (*p == ' ' || *p == '\t') p++;
+            char *next;
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                real x = strtof(p + 2, &next), y = strtof(next, &next), z = strtof(next, &next);
+                ch.v.push_back(vec3(x, y, z));
+                p = next;
+            }
+            else if (p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+                real x = strtof(p + 3, &next), y = strtof(next, &next), z = strtof(next, &next);
+                ch.vn.push_back(vec3(x, y, z));
+                p = next;
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                p += 2;
+                int n = 0;
+                for (;;) {
+                    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+                    if (*p == '\n' || *p == '#') break;
+                    long v = strtol(p, &next, 10);
+                    if (next == p || v == 0) { if (!ch.bad_line) ch.bad_line = int(line - ch.begin) + 1; break; }
+                    p = next;
+                    long vn = 0;
+                    if (*p == '/') {
+                        p++;
+                        strtol(p, &next, 10);   // texture coordinate, unused
+                        p = next;
+                        if (*p == '/') {
+                            p++;
+                            vn = strtol(p, &next, 10);
+                            p = next;
+                        }
+                    }
+                    obj_corner c;
+                    c.v_local = v < 0;
+                    c.v = v > 0 ? v - 1 : int64_t(ch.v.size()) + v;
+                    c.has_normal = vn != 0;
+                    c.vn_local = vn < 0;
+                    c.vn = vn > 0 ? vn - 1 : int64_t(ch.vn.size()) + vn;
+                    ch.corners.push_back(c);
+                    n++;
+                }
+                ch.face_sizes.push_back(n);
+            }
+            while (*p != '\n') p++;
+            p++;
+        }
+    });
+
+    std::vector<vec3> all_v, all_vn;
+    for (const obj_chunk& ch : chunks) {
+        if (ch.bad_line) {
+            error = std::string(path) + ": bad face record at byte " + std::to_string(ch.begin - base + ch.bad_line - 1);
+            return false;
+        }
+        all_v.insert(all_v.end(), ch.v.begin(), ch.v.end());
+        all_vn.insert(all_vn.end(), ch.vn.begin(), ch.vn.end());
+    }
+    const int64_t nv = int64_t(all_v.size()), nvn = int64_t(all_vn.size());
+    mesh.positions.clear();
+    mesh.normals.clear();
+    mesh.indices.clear();
+    std::unordered_map<uint64_t, uint32_t> shared;
+    std::vector<int64_t> face_v, face_vn;
+    int64_t v_base = 0, vn_base = 0;
+    for (const obj_chunk& ch : chunks) {
+        size_t k = 0;
+        for (int n : ch.face_sizes) {
+            face_v.resize(n);
+            face_vn.resize(n);
+            bool flat_corner = false;
+            for (int j = 0; j < n; j++, k++) {
+                const obj_corner& c = ch.corners[k];
+                int64_t v = c.v_local ? v_base + c.v : c.v;
+                int64_t vn = !c.has_normal ? -1 : c.vn_local ? vn_base + c.vn : c.vn;
+                if (v < 0 || v >= nv || vn >= nvn || (c.has_normal && vn < 0)) {
+                    error = std::string(path) + ": face refers to a missing vertex or normal";
+                    return false;
+                }
+                face_v[j] = v;
+                face_vn[j] = vn;
+                flat_corner = flat_corner || vn < 0;
+            }
+            // In a mesh with normals, corners given none take the face's own (Newell) normal.
+            vec3 face_normal(0, 0, 0);
+            if (flat_corner && nvn > 0) {
+                for (int j = 0; j < n; j++) {
+                    const vec3& a = all_v[face_v[j]];
+                    const vec3& b = all_v[face_v[(j+1) % n]];
+                    face_normal += vec3((a.y() - b.y())*(a.z() + b.z()), (a.z() - b.z())*(a.x() + b.x()),
+                                        (a.x() - b.x())*(a.y() + b.y()));
+                }
+                if (face_normal.length() > 0) face_normal.make_unit_vector();
+            }
+            uint32_t ids[2] = { 0, 0 };
+            for (int j = 0; j < n; j++) {
+                int64_t v = face_v[j], vn = face_vn[j];
+                uint32_t id;
+                if (vn < 0 && nvn > 0) {
+                    // the face normal belongs to this face alone, so the vertex is not shared
+                    id = uint32_t(mesh.positions.size());
+                    mesh.positions.push_back(all_v[v]);
+                    mesh.normals.push_back(face_normal);
+                }
+                else {
+                    // one vertex per distinct (position, normal) pair
+                    auto found = shared.emplace(uint64_t(v) << 32 | uint32_t(vn), uint32_t(mesh.positions.size()));
+                    if (found.second) {
+                        mesh.positions.push_back(all_v[v]);
+                        if (nvn > 0) mesh.normals.push_back(all_vn[vn]);
+                    }
+                    id = found.first->second;
+                }
+                if (j < 2) {
+                    ids[j] = id;
+                    continue;
+                }
+                mesh.indices.push_back(ids[0]);
+                mesh.indices.push_back(ids[1]);
+                mesh.indices.push_back(id);
+                ids[1] = id;
+            }
+        }
+        v_base += int64_t(ch.v.size());
+        vn_base += int64_t(ch.vn.size());
+    }
+    if (mesh.indices.empty()) { error = std::string(path) + ": no faces"; return false; }
+    mesh.build();
+    return true;
+}
+
+
+// Loads every mesh of the scene once into meshes (owned by the caller) and returns a BVH over
+// its instances, each placed in the arena and pointing at its shared mesh.
+bvh *make_mesh_instances(const scene_description& scene, const std::vector<material*>& mats, arena& mem,
+                         std::vector<triangle_mesh*>& meshes, int threads, std::string& error) {
+    for (const std::string& path : scene.meshes) {
+        meshes.push_back(new triangle_mesh());
+        if (!load_obj(path.c_str(), *meshes.back(), error, threads))
+            return 0;
+    }
+    hitable **list = mem.create_array<hitable*>(scene.instances.size());
+    for (size_t i = 0; i < scene.instances.size(); i++) {
+        const scene_instance& inst = scene.instances[i];
+        transform to_world = transform::translate(vec3(inst.translate[0], inst.translate[1], inst.translate[2]))
+                           * transform::rotate_y(inst.rotate_y) * transform::scale(inst.scale);
+        list[i] = mem.create<instance>(meshes[inst.mesh], to_world, mats[inst.material]);
+    }
+    return new bvh(list, int(scene.instances.size()));
+}
+
+
+#endif
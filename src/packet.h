@@ -0,0 +1,289 @@
+#ifndef PACKETH
+#define PACKETH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+#include "random.h"
+#include "render.h"
+#include "sampler.h"
+#include "sphere_set.h"
+
+
+// Primary rays for up to side x side neighbouring pixels at one sample index, stored as
+// structure-of-arrays so eight rays fill a vector. Unused lanes repeat the last ray.
+struct ray_packet {
+    static const int side = 8;
+    static const int size = side*side;
+
+    int count = 0;
+    alignas(32) float ox[size], oy[size], oz[size];
+    alignas(32) float dx[size], dy[size], dz[size];
+    alignas(32) float ix[size], iy[size], iz[size];     // reciprocal directions, as traverse() takes them
+    alignas(32) float dd[size];                         // dot(d, d)
+    alignas(32) float closest[size];
+    int best[size];
+
+    void set(int k, const ray& r) {
+        ox[k] = r.A.x(); oy[k] = r.A.y(); oz[k] = r.A.z();
+        dx[k] = r.B.x(); dy[k] = r.B.y(); dz[k] = r.B.z();
+        ix[k] = 1.0f/dx[k]; iy[k] = 1.0f/dy[k]; iz[k] = 1.0f/dz[k];
+        dd[k] = dot(r.B, r.B);
+        closest[k] = FLT_MAX;
+        best[k] = -1;
+    }
+};
+
+
+#ifdef SPHERESET_X86
+
+// Bounds on where any ray of the packet can enter and leave a box, by interval arithmetic over
+// the packet's ranges of origins and reciprocal directions. An axis whose rays do not all point
+// the same way gives no bound.
+struct packet_frustum {
+    float omin[3], omax[3], imin[3], imax[3];
+    bool same_sign[3];
+
+    explicit packet_frustum(const ray_packet& p) {
+        const float *o[3] = { p.ox, p.oy, p.oz };
+        const float *inv[3] = { p.ix, p.iy, p.iz };
+        for (int a = 0; a < 3; a++) {
+            omin[a] = omax[a] = o[a][0];
+            imin[a] = imax[a] = inv[a][0];
+            for (int k = 1; k < p.count; k++) {
+                omin[a] = fminf(omin[a], o[a][k]); omax[a] = fmaxf(omax[a], o[a][k]);
+                imin[a] = fminf(imin[a], inv[a][k]); imax[a] = fmaxf(imax[a], inv[a][k]);
+            }
+            same_sign[a] = (imin[a] > 0 || imax[a] < 0) && isfinite(imin[a]) && isfinite(imax[a]);
+        }
+    }
+
+    // True when no ray can hit box in (t_min, t_max). The bounds are widened a little so that
+    // rounding, which the per-ray tests see differently, never culls a box one of them hits.
+    bool misses(const aabb& box, float t_min, float t_max) const {
+        float enter = t_min, leave = t_max;
+        for (int a = 0; a < 3; a++) {
+            if (!same_sign[a]) continue;
+            float near_face = imin[a] > 0 ? box.min()[a] : box.max()[a];
+            float far_face = imin[a] > 0 ? box.max()[a] : box.min()[a];
+            float lo, hi;
+            product(near_face - omax[a], near_face - omin[a], a, lo, hi);
+            enter = fmaxf(enter, lo - 1e-4f*(fabsf(lo) + 1));
+            product(far_face - omax[a], far_face - omin[a], a, lo, hi);
+            leave = fminf(leave, hi + 1e-4f*(fabsf(hi) + 1));
+        }
+        return leave < enter;
+    }
+
+    void product(float lo, float hi, int a, float& out_lo, float& out_hi) const {
+        float p0 = lo*imin[a], p1 = lo*imax[a], p2 = hi*imin[a], p3 = hi*imax[a];
+        out_lo = fminf(fminf(p0, p1), fminf(p2, p3));
+        out_hi = fmaxf(fmaxf(p0, p1), fmaxf(p2, p3));
+    }
+};
+
+
+// The aabb::hit slab test for eight rays at once, with each ray's own closest hit as its far
+// limit. Returns the lanes that hit.
+__attribute__((target("avx2")))
+inline int packet_box_hit(const ray_packet& p, int k, const aabb& box, __m256 tmin) {
+    __m256 lo = tmin, hi = _mm256_load_ps(&p.closest[k]);
+    const float *o[3] = { p.ox, p.oy, p.oz };
+    const float *inv[3] = { p.ix, p.iy, p.iz };
+    for (int a = 0; a < 3; a++) {
+        __m256 i = _mm256_load_ps(&inv[a][k]);
+        __m256 oa = _mm256_load_ps(&o[a][k]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.min()[a]), oa), i);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.max()[a]), oa), i);
+        __m256 neg = _mm256_cmp_ps(i, _mm256_setzero_ps(), _CMP_LT_OQ);
+        __m256 near_t = _mm256_blendv_ps(t0, t1, neg);
+        __m256 far_t = _mm256_blendv_ps(t1, t0, neg);
+        // same operand order as ffmax/ffmin so NaNs resolve the same way
+        lo = _mm256_blendv_ps(lo, near_t, _mm256_cmp_ps(near_t, lo, _CMP_GT_OQ));
+        hi = _mm256_blendv_ps(hi, far_t, _mm256_cmp_ps(far_t, hi, _CMP_LT_OQ));
+    }
+    return _mm256_movemask_ps(_mm256_cmp_ps(hi, lo, _CMP_GE_OQ));
+}
+
+
+// Nearest hits of every ray of the packet in set, left in closest and best. One walk of the tree
+// serves the whole packet: a node is entered when the first ray hits its box, or failing that
+// when the frustum does not rule it out and some ray hits it. In a leaf each sphere is tested
+// against the eight rays of a vector at a time, only for the vectors with rays that hit the
+// leaf's box, with sphere_set's arithmetic so every ray finds exactly the hit it would alone.
+__attribute__((target("avx2")))
+void intersect_packet(const sphere_set& set, ray_packet& p, float t_min) {
+    const std::vector<bvh_node>& nodes = set.tree.nodes;
+    if (nodes.empty()) return;
+    packet_frustum frustum(p);
+    const int vectors = (p.count + 7) / 8;
+    const __m256 tmin = _mm256_set1_ps(t_min);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    float far_limit = FLT_MAX;      // the largest closest hit over the packet
+    int stack[bvh_tree::max_stack];
+    int sp = 0;
+    int node = 0;
+    vec3 first_origin(p.ox[0], p.oy[0], p.oz[0]);
+    vec3 first_inv(p.ix[0], p.iy[0], p.iz[0]);
+    for (;;) {
+        const bvh_node& n = nodes[node];
+        int masks[ray_packet::size / 8];
+        bool enter = n.box.hit(first_origin, first_inv, t_min, p.closest[0]);
+        bool known = false;
+        if (!enter && !frustum.misses(n.box, t_min, far_limit)) {
+            for (int v = 0; v < vectors; v++) {
+                masks[v] = packet_box_hit(p, 8*v, n.box, tmin);
+                enter = enter || masks[v];
+            }
+            known = true;
+        }
+        if (enter && n.count > 0) {
+            for (int v = 0; v < vectors; v++) {
+                int mask = known ? masks[v] : packet_box_hit(p, 8*v, n.box, tmin);
+                if (!mask) continue;
+                RT_COUNT_N(primitive_tests, n.count * __builtin_popcount(mask));
+                int k = 8*v;
+                __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                    _mm256_and_si256(_mm256_set1_epi32(mask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)),
+                    _mm256_setzero_si256()));
+                __m256 ox = _mm256_load_ps(&p.ox[k]), oy = _mm256_load_ps(&p.oy[k]), oz = _mm256_load_ps(&p.oz[k]);
+                __m256 dx = _mm256_load_ps(&p.dx[k]), dy = _mm256_load_ps(&p.dy[k]), dz = _mm256_load_ps(&p.dz[k]);
+                __m256 a = _mm256_load_ps(&p.dd[k]);
+                __m256 closest = _mm256_load_ps(&p.closest[k]);
+                __m256i best = _mm256_loadu_si256((const __m256i*)&p.best[k]);
+                for (int i = n.offset; i < n.offset + n.count; i++) {
+                    __m256 ocx = _mm256_sub_ps(ox, _mm256_set1_ps(set.cx[i]));
+                    __m256 ocy = _mm256_sub_ps(oy, _mm256_set1_ps(set.cy[i]));
+                    __m256 ocz = _mm256_sub_ps(oz, _mm256_set1_ps(set.cz[i]));
+                    __m256 rad = _mm256_set1_ps(set.radius[i]);
+                    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                                             _mm256_mul_ps(ocz, dz));
+                    __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                                           _mm256_mul_ps(ocz, ocz)),
+                                             _mm256_mul_ps(rad, rad));
+                    __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+                    __m256 valid = _mm256_and_ps(lanes, _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GT_OQ));
+                    if (!_mm256_movemask_ps(valid)) continue;
+                    __m256 sq = _mm256_sqrt_ps(disc);
+                    __m256 nb = _mm256_xor_ps(b, sign);
+                    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(nb, sq), a);
+                    __m256 t2 = _mm256_div_ps(_mm256_add_ps(nb, sq), a);
+                    __m256 ok1 = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t1, closest, _CMP_LT_OQ),
+                                                                    _mm256_cmp_ps(t1, tmin, _CMP_GT_OQ)));
+                    __m256 ok2 = _mm256_andnot_ps(ok1, _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t2, closest, _CMP_LT_OQ),
+                                                                                        _mm256_cmp_ps(t2, tmin, _CMP_GT_OQ))));
+                    __m256 ok = _mm256_or_ps(ok1, ok2);
+                    if (!_mm256_movemask_ps(ok)) continue;
+                    closest = _mm256_blendv_ps(closest, _mm256_blendv_ps(t2, t1, ok1), ok);
+                    best = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best),
+                                                                _mm256_castsi256_ps(_mm256_set1_epi32(i)), ok));
+                }
+                _mm256_store_ps(&p.closest[k], closest);
+                _mm256_storeu_si256((__m256i*)&p.best[k], best);
+            }
+            far_limit = p.closest[0];
+            for (int k = 1; k < p.count; k++) far_limit = fmaxf(far_limit, p.closest[k]);
+        }
+        else if (enter) {
+            // nearer child first, by the first ray, as traverse() orders it for each ray
+            if (p.dx[0]*(n.axis == 0) + p.dy[0]*(n.axis == 1) + p.dz[0]*(n.axis == 2) < 0) {
+                stack[sp++] = node+1;
+                node = n.offset;
+            }
+            else {
+                stack[sp++] = n.offset;
+                node = node+1;
+            }
+            continue;
+        }
+        if (sp == 0) break;
+        node = stack[--sp];
+    }
+}
+
+#endif
+
+
+// render() with every tile's primary rays traced as packets of up to 8x8 pixels at one sample
+// index. Each ray's sample is drawn as trace_sample() draws it and its generator and sampler state
+// are set aside; after the packet's nearest hits are found each path picks its state back up and
+// continues alone through color_from_hit(), since bounced rays no longer travel together. The
+// image is the same as render()'s. Needs the world to be a sphere_set and an AVX2 machine, and
+// falls back to render() otherwise.
+path_stats render_packets(const camera& cam, hitable *world, const render_settings& settings, framebuffer& fb) {
+#ifdef SPHERESET_X86
+    const sphere_set *set = dynamic_cast<const sphere_set*>(world);
+    if (!set || !set->use_avx2)
+        return render(cam, world, settings, fb);
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, settings.tile_size);
+    std::vector<path_stats> per_thread(settings.threads < 1 ? 1 : settings.threads);
+    parallel_for_work_stealing(int(tiles.size()), settings.threads, [&](int job, int thread) {
+        const tile& t = tiles[job];
+        RT_TIME_TILE(t);
+        path_stats& stats = per_thread[thread];
+        ray_packet packet;
+        ray rays[ray_packet::size];
+        pcg32 rngs[ray_packet::size];
+        sample_stream streams[ray_packet::size];
+        vec3 sums[ray_packet::size];
+        for (int y0 = t.y0; y0 < t.y1; y0 += ray_packet::side) {
+            for (int x0 = t.x0; x0 < t.x1; x0 += ray_packet::side) {
+                int w = t.x1 - x0 < ray_packet::side ? t.x1 - x0 : ray_packet::side;
+                int h = t.y1 - y0 < ray_packet::side ? t.y1 - y0 : ray_packet::side;
+                int count = w*h;
+                for (int k = 0; k < count; k++) sums[k] = vec3(0, 0, 0);
+                for (int s = 0; s < settings.ns; s++) {
+                    for (int k = 0; k < count; k++) {
+                        int i = x0 + k % w, j = y0 + k / w;
+                        thread_rng() = rng_for_sample(j*fb.nx + i, s, settings.frame);
+                        begin_sample(settings.sampling, i, j, s, settings.frame);
+                        double jitter[2];
+                        sample_2d(jitter);
+                        real u = real(i + jitter[0]) / real(fb.nx);
+                        real v = real(j + jitter[1]) / real(fb.ny);
+                        rays[k] = cam.get_ray(u, v);
+                        rngs[k] = thread_rng();
+                        streams[k] = thread_samples();
+                        packet.set(k, rays[k]);
+                    }
+                    packet.count = count;
+                    for (int k = count; k < (count + 7) / 8 * 8; k++) packet.set(k, rays[count-1]);
+                    intersect_packet(*set, packet, 0.001f);
+                    for (int k = 0; k < count; k++) {
+                        thread_rng() = rngs[k];
+                        thread_samples() = streams[k];
+                        hit_record rec;
+                        bool found = packet.best[k] >= 0;
+                        if (found) set->hit_record_at(rays[k], packet.best[k], packet.closest[k], rec);
+                        stats.paths++;
+                        stats.rays++;
+                        RT_COUNT(primary_rays);
+                        sums[k] += color_from_hit(rays[k], found, rec, world, 0, settings.paths, vec3(1,1,1), stats);
+                    }
+                }
+                for (int k = 0; k < count; k++)
+                    fb.at(x0 + k % w, y0 + k / w) = sums[k] / real(settings.ns);
+            }
+        }
+    });
+    path_stats total;
+    for (const path_stats& s : per_thread)
+        total.add(s);
+    return total;
+#else
+    return render(cam, world, settings, fb);
+#endif
+}
+
+
+#endif
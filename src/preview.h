@@ -0,0 +1,187 @@
+#ifndef PREVIEWH
+#define PREVIEWH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <chrono>
+#include <vector>
+#include "progressive.h"
+#include "render.h"
+
+
+struct preview_settings {
+    double budget_seconds = 0.1;
+    int coarse_stride = 8;      // block size of the first pass, in pixels; halved every pass down to 1
+    int coarse_depth = 1;       // bounce cap of the first pass; doubled with each halving
+};
+
+
+// What one refinement step drew. Full-resolution steps add samples [first_sample, last_sample)
+// to every tile they reach; coarse steps trace one sample per stride x stride block.
+struct preview_step {
+    int index = -1;
+    int stride = 0;
+    int first_sample = 0, last_sample = 0;
+    int max_depth = 0;
+    bool complete = false;      // every tile was reached before the deadline
+    double seconds = 0;         // since the preview started
+};
+
+
+// Expected rays per path when every bounce survives with probability p and the cap is max_depth:
+// 1 + p + ... + p^max_depth.
+inline double rays_per_path_at(double p, int max_depth) {
+    double sum = 1, term = 1;
+    for (int d = 0; d < max_depth; d++) {
+        term *= p;
+        sum += term;
+    }
+    return sum;
+}
+
+
+// The survival probability that explains a measured path length under a cap, by bisection, so a
+// pass at one depth can predict the cost of the next, deeper one.
+inline double bounce_survival(double rays_per_path, int max_depth) {
+    double lo = 0, hi = 1;
+    for (int it = 0; it < 40; it++) {
+        double mid = 0.5*(lo + hi);
+        if (rays_per_path_at(mid, max_depth) < rays_per_path) lo = mid; else hi = mid;
+    }
+    return 0.5*(lo + hi);
+}
+
+
+// Coarse to fine within a time budget: blocky passes at 1 spp with few bounces, then full
+// resolution at the settings' depth, doubling the samples per pixel each pass up to settings.ns.
+// Every tile's cost per ray is measured on each pass and, with the average path length, predicts
+// the next pass; a resolution step that would not fit ends the preview, and a sample step shrinks
+// to the number of samples that fits. Workers also skip tiles once the deadline passes, so a late
+// step leaves a mix of its tiles and the previous step's rather than running over. on_step(fb,
+// step) sees the image after every step, on the calling thread and inside the budget. The first
+// step always finishes, so fb holds a whole image however small the budget. Given enough time the
+// result equals render_progressive()'s.
+template <typename Callback>
+preview_step render_preview(const camera& cam, hitable *world, const render_settings& settings,
+                            const preview_settings& opts, framebuffer& fb, Callback on_step) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    clock::time_point deadline = start + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(opts.budget_seconds));
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, settings.tile_size);
+    const int ntiles = int(tiles.size());
+    const int nthreads = settings.threads < 1 ? 1 : settings.threads;
+    progressive_state st(fb.nx, fb.ny, settings.frame);
+    std::vector<double> ray_cost(ntiles, 0);    // seconds per ray, from each tile's last pass
+    std::vector<path_stats> tile_stats(ntiles);
+    std::vector<char> reached(ntiles);
+    double rays_per_path = 1;
+    int stride = opts.coarse_stride < 1 ? 1 : opts.coarse_stride;
+    int depth = opts.coarse_depth < 1 ? 1 : opts.coarse_depth;
+    preview_step last;
+
+    for (int index = 0; ; index++) {
+        preview_step step;
+        step.index = index;
+        step.stride = stride;
+        if (stride > 1) {
+            step.last_sample = 1;
+            step.max_depth = depth < settings.paths.max_depth ? depth : settings.paths.max_depth;
+        }
+        else {
+            step.first_sample = st.samples_done;
+            int n = st.samples_done > 0 ? st.samples_done : 1;
+            step.last_sample = step.first_sample + n < settings.ns ? step.first_sample + n : settings.ns;
+            step.max_depth = settings.paths.max_depth;
+        }
+        if (step.first_sample >= step.last_sample) break;
+
+        if (index > 0) {
+            double rpp = rays_per_path;
+            if (step.max_depth != last.max_depth)
+                rpp = rays_per_path_at(bounce_survival(rays_per_path, last.max_depth), step.max_depth);
+            double per_sample = 0;
+            for (int t = 0; t < ntiles; t++) {
+                const tile& tl = tiles[t];
+                int bx = (tl.x1 - tl.x0 + stride - 1) / stride, by = (tl.y1 - tl.y0 + stride - 1) / stride;
+                per_sample += ray_cost[t] * rpp * bx * by;
+            }
+            per_sample /= nthreads;
+            double remaining = std::chrono::duration<double>(deadline - clock::now()).count();
+            if (stride > 1 || step.first_sample == 0) {
+                if (per_sample > remaining) break;
+            }
+            else {
+                int fits = per_sample > 0 ? int(remaining / per_sample) : step.last_sample - step.first_sample;
+                if (fits < 1) break;
+                if (step.first_sample + fits < step.last_sample) step.last_sample = step.first_sample + fits;
+            }
+        }
+
+        render_settings shallow = settings;
+        shallow.paths.max_depth = step.max_depth;
+        parallel_for_work_stealing(ntiles, nthreads, [&](int job, int) {
+            reached[job] = index == 0 || clock::now() < deadline;
+            if (!reached[job]) return;
+            clock::time_point t0 = clock::now();
+            const tile& t = tiles[job];
+            RT_TIME_TILE(t);
+            path_stats stats;
+            if (stride > 1) {
+                for (int y = t.y0; y < t.y1; y += stride) {
+                    int y1 = y + stride < t.y1 ? y + stride : t.y1;
+                    for (int x = t.x0; x < t.x1; x += stride) {
+                        int x1 = x + stride < t.x1 ? x + stride : t.x1;
+                        vec3 c = trace_sample(cam, world, (x + x1) / 2, (y + y1) / 2, 0, fb.nx, fb.ny, shallow, stats);
+                        for (int j = y; j < y1; j++)
+                            for (int i = x; i < x1; i++)
+                                fb.at(i, j) = c;
+                    }
+                }
+            }
+            else {
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        int p = j*st.nx + i;
+                        for (int s = step.first_sample; s < step.last_sample; s++)
+                            st.sum[p] += trace_sample(cam, world, i, j, s, st.nx, st.ny, shallow, stats);
+                        st.count[p] += step.last_sample - step.first_sample;
+                        fb.pixels[p] = st.sum[p] / real(st.count[p]);
+                    }
+                }
+            }
+            double seconds = std::chrono::duration<double>(clock::now() - t0).count();
+            ray_cost[job] = stats.rays > 0 ? seconds / double(stats.rays) : ray_cost[job];
+            tile_stats[job] = stats;
+        });
+
+        path_stats total;
+        step.complete = true;
+        for (int t = 0; t < ntiles; t++) {
+            if (!reached[t]) { step.complete = false; continue; }
+            total.add(tile_stats[t]);
+        }
+        if (total.paths > 0) rays_per_path = double(total.rays) / double(total.paths);
+        if (stride == 1) st.samples_done = step.last_sample;
+        step.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        on_step((const framebuffer&)fb, (const preview_step&)step);
+        last = step;
+        if (!step.complete) break;
+        if (stride > 1) {
+            stride /= 2;
+            depth *= 2;
+        }
+    }
+    return last;
+}
+
+
+#endif
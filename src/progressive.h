@@ -0,0 +1,180 @@
+#ifndef PROGRESSIVEH
+#define PROGRESSIVEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "render.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+// Everything a progressive render needs to continue: per-pixel radiance sums and sample counts,
+// plus the pass state. Samples are seeded from (pixel, sample, frame), so samples_done and frame
+// are the whole generator state; resuming draws exactly the numbers an uninterrupted run would.
+// The sampler, path policy and scene the sums were taken with must match for a resume.
+struct progressive_state {
+    progressive_state(int w, int h, int f)
+        : nx(w), ny(h), frame(f), samples_done(0), sum(w*h, vec3(0,0,0)), count(w*h, 0) {}
+
+    int nx, ny, frame;
+    int samples_done;
+    int sampling = 0;       // a sampler_type
+    path_policy paths;
+    uint64_t scene = 0;     // scene_hash() of the scene
+    std::vector<vec3> sum;
+    std::vector<uint32_t> count;
+};
+
+
+struct progressive_settings {
+    int samples_per_pass = 1;
+    const char *checkpoint = 0;     // no checkpoints when null
+    double checkpoint_seconds = 60; // at most one checkpoint per interval; 0 checkpoints every pass
+};
+
+
+static const char checkpoint_magic[8] = { 'R','T','C','K','P','T','0','2' };
+
+
+// Makes a rename in path's directory durable. Without this a crash can lose the rename even
+// though the file it names was synced.
+bool sync_directory_of(const char *path) {
+#if defined(__unix__) || defined(__APPLE__)
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#else
+    (void)path;
+    return true;
+#endif
+}
+
+
+// Native-endian dump: magic, nine int32 fields (size, frame, samples done, sizeof(vec3), sampler
+// and path policy), the scene hash, then the sums and counts. Written to a temporary file that is
+// synced and renamed over the old checkpoint, and the rename synced, so a crash at any point
+// leaves either the previous checkpoint or the new one.
+bool save_checkpoint(const char *path, const progressive_state& st) {
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    int32_t header[9] = { st.nx, st.ny, st.frame, st.samples_done, int32_t(sizeof(vec3)), st.sampling,
+                          st.paths.russian_roulette, st.paths.min_depth, st.paths.max_depth };
+    bool ok = fwrite(checkpoint_magic, 1, 8, f) == 8
+           && fwrite(header, sizeof(header), 1, f) == 1
+           && fwrite(&st.scene, sizeof(st.scene), 1, f) == 1
+           && fwrite(&st.sum[0], sizeof(vec3), st.sum.size(), f) == st.sum.size()
+           && fwrite(&st.count[0], sizeof(uint32_t), st.count.size(), f) == st.count.size()
+           && fflush(f) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return sync_directory_of(path);
+}
+
+
+// Returns true when st was loaded from path. A missing file returns false with error left empty,
+// so the render starts fresh; an unreadable or truncated file, or one written for another image
+// size, frame, sampler, path policy or scene, returns false with error set, since continuing would
+// overwrite it or average two different renders into one image.
+bool load_checkpoint(const char *path, progressive_state& st, std::string& error) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    char magic[8];
+    int32_t header[9];
+    uint64_t scene;
+    bool ok = fread(magic, 1, 8, f) == 8 && !memcmp(magic, checkpoint_magic, 8)
+           && fread(header, sizeof(header), 1, f) == 1
+           && fread(&scene, sizeof(scene), 1, f) == 1;
+    if (!ok) {
+        error = std::string(path) + ": not a checkpoint";
+    } else if (header[0] != st.nx || header[1] != st.ny || header[2] != st.frame
+               || header[4] != int32_t(sizeof(vec3))) {
+        error = std::string(path) + ": checkpoint is for another image size, frame or build";
+    } else if (header[5] != st.sampling || header[6] != int32_t(st.paths.russian_roulette)
+               || header[7] != st.paths.min_depth || header[8] != st.paths.max_depth) {
+        error = std::string(path) + ": checkpoint was rendered with another sampler or path policy";
+    } else if (scene != st.scene) {
+        error = std::string(path) + ": checkpoint was rendered from another scene";
+    } else {
+        ok = fread(&st.sum[0], sizeof(vec3), st.sum.size(), f) == st.sum.size()
+          && fread(&st.count[0], sizeof(uint32_t), st.count.size(), f) == st.count.size();
+        if (ok) st.samples_done = header[3];
+        else error = std::string(path) + ": checkpoint is truncated";
+    }
+    fclose(f);
+    return error.empty() && ok;
+}
+
+
+// Renders passes until st holds settings.ns samples per pixel, checkpointing along the way, and
+// leaves the averaged image in fb. Raising settings.ns on a loaded state continues where it
+// stopped. Per-pixel sums accumulate in sample order, so the result equals render()'s.
+bool render_progressive(const camera& cam, hitable *world, const render_settings& settings,
+                        const progressive_settings& prog, progressive_state& st, framebuffer& fb) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<tile> tiles = make_tiles(st.nx, st.ny, settings.tile_size);
+    clock::time_point last_checkpoint = clock::now();
+    int per_pass = prog.samples_per_pass < 1 ? 1 : prog.samples_per_pass;
+
+    while (st.samples_done < settings.ns) {
+        int first = st.samples_done;
+        int last = first + per_pass < settings.ns ? first + per_pass : settings.ns;
+        parallel_for_work_stealing(int(tiles.size()), settings.threads, [&](int job, int) {
+            const tile& t = tiles[job];
+            RT_TIME_TILE(t);
+            path_stats stats;
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    int p = j*st.nx + i;
+                    for (int s = first; s < last; s++)
+                        st.sum[p] += trace_sample(cam, world, i, j, s, st.nx, st.ny, settings, stats);
+                    st.count[p] += last - first;
+                }
+            }
+        });
+        st.samples_done = last;
+
+        double elapsed = std::chrono::duration<double>(clock::now() - last_checkpoint).count();
+        bool done = st.samples_done >= settings.ns;
+        if (prog.checkpoint && (done || elapsed >= prog.checkpoint_seconds)) {
+            if (!save_checkpoint(prog.checkpoint, st))
+                return false;
+            last_checkpoint = clock::now();
+        }
+    }
+
+    for (size_t p = 0; p < st.sum.size(); p++)
+        fb.pixels[p] = st.count[p] ? st.sum[p] / real(st.count[p]) : vec3(0,0,0);
+    return true;
+}
+
+
+#endif
@@ -1,10 +1,85 @@
 #ifndef RANDOMH
 #define RANDOMH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
 
-#include <cstdlib>
+#include <stdint.h>
+
+
+// PCG32 (XSH-RR variant, see pcg-random.org): 64 bits of state, an odd stream increment, and
+// 32-bit outputs.
+class pcg32 {
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+        pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+        void seed(uint64_t initstate, uint64_t initseq) {
+            state = 0;
+            inc = (initseq << 1) | 1;
+            next_uint();
+            state += initstate;
+            next_uint();
+        }
+
+        uint32_t next_uint() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+            uint32_t rot = uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        // Uniform in [0,1). Floats use the top 24 bits so 1.0f can never come out.
+        double next_double() { return next_uint() * (1.0 / 4294967296.0); }
+        float next_float() { return (next_uint() >> 8) * (1.0f / 16777216.0f); }
+
+        void fill(float *out, int n) {
+            for (int i = 0; i < n; i++)
+                out[i] = next_float();
+        }
+
+        uint64_t state;
+        uint64_t inc;
+};
+
+
+// splitmix64 finalizer, used to turn structured counters into well-spread seeds.
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+// A generator that depends only on (pixel, sample, frame), so a render gives the same bits no
+// matter how its pixels are split across threads.
+inline pcg32 rng_for_sample(uint64_t pixel, uint64_t sample, uint64_t frame) {
+    return pcg32(mix64(pixel ^ mix64(sample ^ mix64(frame))), pixel);
+}
+
+
+// Each thread owns a generator. Renderers reseed it with rng_for_sample() before tracing a
+// sample; everything else just draws from it.
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
 
 inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+    return thread_rng().next_double();
+}
+
+// Batch form for callers that want a buffer of uniforms at once.
+inline void random_fill(float *out, int n) {
+    thread_rng().fill(out, n);
 }
 
 #endif
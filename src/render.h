@@ -0,0 +1,195 @@
+#ifndef RENDERH
+#define RENDERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <chrono>
+#include <vector>
+#include "float.h"
+#include "aabb.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "instrument.h"
+#include "hitable.h"
+#include "material.h"
+#include "random.h"
+#include "sampler.h"
+#include "tile_scheduler.h"
+
+
+vec3 sky_color(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    real t = 0.5*(unit_direction.y() + 1.0);
+    return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+}
+
+
+// How paths end. With roulette off a path stops after max_depth bounces, the book's fixed
+// cutoff of 50. With it on, a path that has bounced min_depth times survives each further bounce
+// with probability equal to its largest throughput component and is reweighted by the inverse,
+// which keeps the estimate unbiased; max_depth stays as a hard cap either way.
+struct path_policy {
+    bool russian_roulette = false;
+    int min_depth = 3;
+    int max_depth = 50;
+};
+
+
+// The probability that roulette keeps a path reaching bounce depth with the given throughput;
+// 1 while roulette is off or has not started. Every integrator uses this test, so they all end
+// the same paths.
+inline real survival_probability(const path_policy& policy, int depth, const vec3& throughput) {
+    if (!policy.russian_roulette || depth < policy.min_depth) return 1;
+    real q = ffmax(throughput.x(), ffmax(throughput.y(), throughput.z()));
+    return q < 1 ? q : 1;
+}
+
+
+// Counts for reporting average path length and ray throughput.
+struct path_stats {
+    long long paths = 0;
+    long long rays = 0;
+
+    void add(const path_stats& other) {
+        paths += other.paths;
+        rays += other.rays;
+    }
+};
+
+
+vec3 color(const ray& r, hitable *world, int depth, const path_policy& policy, const vec3& throughput,
+           path_stats& stats);
+
+
+// The rest of color() once the ray's nearest hit is known, in rec if found is set. Lets callers
+// that find hits some other way, such as whole packets at once, carry on with single rays.
+vec3 color_from_hit(const ray& r, bool found, const hit_record& rec, hitable *world, int depth,
+                    const path_policy& policy, const vec3& throughput, path_stats& stats) {
+    if (found) {
+        ray scattered;
+        vec3 attenuation;
+        RT_COUNT(material_hits[rec.mat_ptr->kind()]);
+        if (depth < policy.max_depth && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+            vec3 next = throughput*attenuation;
+            real q = survival_probability(policy, depth+1, next);
+            if (q < 1) {
+                if (random_double() >= q) {
+                    RT_COUNT_DEPTH(depth+1);
+                    return vec3(0,0,0);
+                }
+                return attenuation*color(scattered, world, depth+1, policy, next/q, stats) / q;
+            }
+            return attenuation*color(scattered, world, depth+1, policy, next, stats);
+        }
+        else {
+            RT_COUNT_DEPTH(depth+1);
+            return vec3(0,0,0);
+        }
+    }
+    else {
+        RT_COUNT_DEPTH(depth+1);
+        return sky_color(r);
+    }
+}
+
+
+vec3 color(const ray& r, hitable *world, int depth, const path_policy& policy, const vec3& throughput,
+           path_stats& stats) {
+    hit_record rec;
+    stats.rays++;
+    if (depth == 0) RT_COUNT(primary_rays); else RT_COUNT(secondary_rays);
+    bool found = world->hit(r, 0.001, MAXFLOAT, rec);
+    return color_from_hit(r, found, rec, world, depth, policy, throughput, stats);
+}
+
+
+struct render_settings {
+    int ns = 10;
+    int threads = default_thread_count();
+    int tile_size = 16;
+    int frame = 0;      // mixed into every sample's seed
+    path_policy paths;
+    const sampler *sampling = 0;    // null draws everything from thread_rng()
+};
+
+
+// One camera sample through pixel (i,j), with its own generator so the result depends only on
+// (pixel, sample, frame). shade(r, stats) follows the camera ray, so integrators with another
+// world or material representation share the sampling.
+template <typename Shade>
+vec3 trace_sample(const camera& cam, int i, int j, int s, int nx, int ny, const render_settings& settings,
+                  path_stats& stats, const Shade& shade) {
+    thread_rng() = rng_for_sample(j*nx + i, s, settings.frame);
+    begin_sample(settings.sampling, i, j, s, settings.frame);
+    double jitter[2];
+    sample_2d(jitter);
+    real u = real(i + jitter[0]) / real(nx);
+    real v = real(j + jitter[1]) / real(ny);
+    ray r = cam.get_ray(u, v);
+    stats.paths++;
+    return shade(r, stats);
+}
+
+
+vec3 trace_sample(const camera& cam, hitable *world, int i, int j, int s, int nx, int ny,
+                  const render_settings& settings, path_stats& stats) {
+    return trace_sample(cam, i, j, s, nx, ny, settings, stats, [&](const ray& r, path_stats& st) {
+        return color(r, world, 0, settings.paths, vec3(1,1,1), st);
+    });
+}
+
+
+template <typename Shade>
+void render_tile(const tile& t, const camera& cam, const render_settings& settings, framebuffer& fb,
+                 path_stats& stats, const Shade& shade) {
+    int ns = settings.ns;
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            vec3 col(0, 0, 0);
+            for (int s=0; s < ns; s++)
+                col += trace_sample(cam, i, j, s, fb.nx, fb.ny, settings, stats, shade);
+            fb.at(i, j) = col / real(ns);
+        }
+    }
+}
+
+
+void render_tile(const tile& t, const camera& cam, hitable *world, const render_settings& settings,
+                 framebuffer& fb, path_stats& stats) {
+    render_tile(t, cam, settings, fb, stats, [&](const ray& r, path_stats& st) {
+        return color(r, world, 0, settings.paths, vec3(1,1,1), st);
+    });
+}
+
+
+// Tiles write disjoint pixels of fb, so workers need no synchronization beyond the scheduler.
+template <typename Shade>
+path_stats render_tiles(const camera& cam, const render_settings& settings, framebuffer& fb, const Shade& shade) {
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, settings.tile_size);
+    std::vector<path_stats> per_thread(settings.threads < 1 ? 1 : settings.threads);
+    parallel_for_work_stealing(int(tiles.size()), settings.threads, [&](int job, int thread) {
+        RT_TIME_TILE(tiles[job]);
+        render_tile(tiles[job], cam, settings, fb, per_thread[thread], shade);
+    });
+    path_stats total;
+    for (const path_stats& s : per_thread)
+        total.add(s);
+    return total;
+}
+
+
+path_stats render(const camera& cam, hitable *world, const render_settings& settings, framebuffer& fb) {
+    return render_tiles(cam, settings, fb, [&](const ray& r, path_stats& st) {
+        return color(r, world, 0, settings.paths, vec3(1,1,1), st);
+    });
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "aabb.h"
+#include "random.h"
+#include "vec3.h"
+
+
+// Where a sample's random numbers come from. Every draw is a function of (pixel, sample index,
+// frame, dimension), so renders stay independent of thread count whichever sampler is used.
+class sampler {
+    public:
+        virtual ~sampler() {}
+        // Dimensions 2*pair and 2*pair+1 of sample index of pixel (x,y), each in [0,1).
+        virtual void sample_2d(int x, int y, uint32_t index, uint32_t frame, int pair, double out[2]) const = 0;
+        // Just dimension 2*pair, for samplers that can skip the other half of the pair.
+        virtual double sample_1d(int x, int y, uint32_t index, uint32_t frame, int pair) const {
+            double out[2];
+            sample_2d(x, y, index, frame, pair, out);
+            return out[0];
+        }
+};
+
+
+// The sample a thread is tracing and how many dimension pairs it has used so far. With no
+// source the draws come from thread_rng(), which is what every renderer did before samplers.
+struct sample_stream {
+    const sampler *source = 0;
+    int x = 0, y = 0;
+    uint32_t index = 0, frame = 0;
+    int pair = 0;
+};
+
+inline sample_stream& thread_samples() {
+    thread_local sample_stream stream;
+    return stream;
+}
+
+inline void begin_sample(const sampler *source, int x, int y, uint32_t index, uint32_t frame) {
+    sample_stream& s = thread_samples();
+    s.source = source;
+    s.x = x; s.y = y;
+    s.index = index; s.frame = frame;
+    s.pair = 0;
+}
+
+// The next two dimensions of the current sample.
+inline void sample_2d(double out[2]) {
+    sample_stream& s = thread_samples();
+    if (s.source) {
+        s.source->sample_2d(s.x, s.y, s.index, s.frame, s.pair++, out);
+    }
+    else {
+        out[0] = random_double();
+        out[1] = random_double();
+    }
+}
+
+// One dimension; a whole pair is used so later pairs keep their place in the sequence.
+inline double sample_1d() {
+    sample_stream& s = thread_samples();
+    if (s.source)
+        return s.source->sample_1d(s.x, s.y, s.index, s.frame, s.pair++);
+    return random_double();
+}
+
+inline bool sampling_enabled() { return thread_samples().source != 0; }
+
+
+// Rejection-free mappings from the unit square.
+
+// Shirley and Chiu's concentric map, which keeps strata compact on the disk.
+inline vec3 concentric_disk(real u1, real u2) {
+    real a = 2*u1 - 1;
+    real b = 2*u2 - 1;
+    if (a == 0 && b == 0) return vec3(0,0,0);
+    real r, phi;
+    if (a*a > b*b) {
+        r = a;
+        phi = real(M_PI/4) * (b/a);
+    }
+    else {
+        r = b;
+        phi = real(M_PI/2) - real(M_PI/4) * (a/b);
+    }
+    return vec3(r*cos(phi), r*sin(phi), 0);
+}
+
+// Cube root for [0,1]: an exponent-thirding bit trick refined by two Newton steps, good to about
+// 1e-6, which is plenty for a sampling radius, at a fraction of cbrtf()'s cost.
+inline float unit_cbrt(float a) {
+    uint32_t i;
+    memcpy(&i, &a, sizeof(i));
+    i = i/3 + 0x2a514067u;
+    float x;
+    memcpy(&x, &i, sizeof(x));
+    for (int k = 0; k < 2; k++)
+        x -= (x - a/(x*x)) * (1.0f/3);
+    return x;
+}
+
+inline double unit_cbrt(double a) { return cbrt(a); }
+
+// Uniform in the unit ball: a direction from (u1,u2) and a radius from u3.
+inline vec3 uniform_ball(real u1, real u2, real u3) {
+    real z = 1 - 2*u1;
+    real rxy = sqrt(ffmax(real(0), 1 - z*z));
+    real phi = real(2*M_PI) * u2;
+    real r = unit_cbrt(u3);
+    return vec3(r*rxy*cos(phi), r*rxy*sin(phi), r*z);
+}
+
+
+inline uint32_t reverse_bits(uint32_t x) {
+#if defined(__GNUC__)
+    x = __builtin_bswap32(x);
+#else
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+#endif
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Laine and Karras' hash as improved by Burley ("Practical Hash-based Owen Scrambling", 2020).
+// On a bit-reversed value each bit is flipped depending only on the bits below it, which are the
+// more significant digits of the value it came from: an Owen scramble in the reversed domain.
+inline uint32_t owen_hash(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(owen_hash(reverse_bits(x), seed));
+}
+
+// One hash per draw: the pixel and dimension pair are packed side by side and the frame spread
+// over all 64 bits by an odd multiplier.
+inline uint32_t sample_seed(uint32_t pixel, uint32_t pair, uint32_t frame) {
+    return uint32_t(mix64((uint64_t(pixel) << 32 | pair) ^ frame * 0x9e3779b97f4a7c15ULL));
+}
+
+inline double to_unit(uint32_t x) { return x * (1.0 / 4294967296.0); }
+
+// The first two Sobol dimensions, bit-reversed so they feed owen_hash() directly: the van der
+// Corput sequence (whose reversal is just the index) and its Pascal-matrix partner.
+inline uint32_t sobol_0_reversed(uint32_t i) { return i; }
+
+// Bit j of the result is the parity of the index bits k with C(k,j) odd, which by Lucas' theorem
+// are the k whose bits include j's: a superset transform done five bit-planes at a time rather
+// than one index bit per iteration (scrambled indices use all 32).
+inline uint32_t sobol_1_reversed(uint32_t i) {
+    i ^= (i >> 1) & 0x55555555u;
+    i ^= (i >> 2) & 0x33333333u;
+    i ^= (i >> 4) & 0x0f0f0f0fu;
+    i ^= (i >> 8) & 0x00ff00ffu;
+    i ^= (i >> 16) & 0x0000ffffu;
+    return i;
+}
+
+// Owen-scrambled point index of 2D Sobol; the index itself is shuffled first so that padded
+// dimension pairs see their samples in unrelated orders.
+inline void sobol_2d(uint32_t index, uint32_t seed, double out[2]) {
+    uint32_t i = owen_scramble(index, seed);
+    out[0] = to_unit(reverse_bits(owen_hash(sobol_0_reversed(i), seed ^ 0xa511e9b3u)));
+    out[1] = to_unit(reverse_bits(owen_hash(sobol_1_reversed(i), seed ^ 0x63d83595u)));
+}
+
+
+// Owen-scrambled 2D Sobol points, padded to any number of dimensions: each pair shuffles the
+// sample order with its own seed, so pairs are stratified on their own and uncorrelated with
+// each other.
+class sobol_sampler : public sampler {
+    public:
+        virtual void sample_2d(int x, int y, uint32_t index, uint32_t frame, int pair, double out[2]) const {
+            sobol_2d(index, sample_seed(uint32_t(y) << 16 ^ uint32_t(x), pair, frame), out);
+        }
+        virtual double sample_1d(int x, int y, uint32_t index, uint32_t frame, int pair) const {
+            uint32_t seed = sample_seed(uint32_t(y) << 16 ^ uint32_t(x), pair, frame);
+            return to_unit(reverse_bits(owen_hash(sobol_0_reversed(owen_scramble(index, seed)), seed ^ 0xa511e9b3u)));
+        }
+};
+
+
+// Radical inverses in successive prime bases, scrambled per pixel. Each digit goes through an
+// affine permutation d -> (a*d + c) mod base hashed from the digits above it, a nested scramble
+// that keeps the strata and, unlike a plain shift, spreads consecutive samples apart in high
+// bases. Halton degrades there anyway, so dimensions past the prime table fall back to thread_rng().
+class halton_sampler : public sampler {
+    public:
+        static const int num_primes = 64;
+
+        static uint32_t hash32(uint32_t x) {
+            x ^= x >> 16; x *= 0x7feb352du;
+            x ^= x >> 15; x *= 0x846ca68bu;
+            x ^= x >> 16;
+            return x;
+        }
+
+        // A digit's permutation d -> (a*d + c) mod base, with a and c taken from the two halves
+        // of a hash by multiply-shift rather than division; a is nonzero, so with a prime base
+        // the map is a bijection.
+        static uint32_t digit_multiplier(uint32_t h, uint32_t base) {
+            return 1 + uint32_t((uint64_t(h >> 16) * (base - 1)) >> 16);
+        }
+        static uint32_t digit_offset(uint32_t h, uint32_t base) {
+            return uint32_t((uint64_t(h & 0xffff) * base) >> 16);
+        }
+
+        static double scrambled_radical_inverse(uint32_t base, uint32_t i, uint32_t seed) {
+            // The scrambled digits collect as an integer over base^digits, both exact in a
+            // double, so one rounded division leaves every result inside its stratum.
+            uint64_t digits = 0, scale = 1;
+            uint32_t prefix = seed;
+            while (i) {
+                uint32_t digit = i % base;
+                i /= base;
+                uint32_t h = hash32(prefix);
+                digits = digits*base + (digit_multiplier(h, base)*digit + digit_offset(h, base)) % base;
+                scale *= base;
+                prefix = h + (digit + 1)*0x9e3779b9u;
+            }
+            // The digits past the index's are zeros and go through the same permutations as
+            // every other index's digits, or short indices would not keep to their strata. They
+            // run until the rest could move the result by less than a float's epsilon.
+            while (scale <= uint64_t(1 / FLT_EPSILON)) {
+                uint32_t h = hash32(prefix);
+                digits = digits*base + digit_offset(h, base);
+                scale *= base;
+                prefix = h + 0x9e3779b9u;
+            }
+            double r = double(digits) / double(scale);
+            return r < 1 ? r : 0x1.fffffffffffffp-1;
+        }
+
+        virtual void sample_2d(int x, int y, uint32_t index, uint32_t frame, int pair, double out[2]) const {
+            static const uint32_t primes[num_primes] = {
+                  2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+                 59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+                137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+                227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311 };
+            if (2*pair + 1 >= num_primes) {
+                out[0] = random_double();
+                out[1] = random_double();
+                return;
+            }
+            uint32_t seed = sample_seed(uint32_t(y) << 16 ^ uint32_t(x), pair, frame);
+            out[0] = scrambled_radical_inverse(primes[2*pair], index, seed);
+            out[1] = scrambled_radical_inverse(primes[2*pair + 1], index, hash32(seed));
+        }
+};
+
+
+// A tileable mask whose values are ranks arranged as blue noise, made with Ulichney's
+// void-and-cluster method on a torus.
+std::vector<float> make_blue_noise_mask(int size, uint64_t seed) {
+    const int n = size*size;
+    const double sigma = 1.9;
+    std::vector<double> kernel(n);
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            int wx = dx < size - dx ? dx : size - dx;
+            int wy = dy < size - dy ? dy : size - dy;
+            kernel[dy*size + dx] = exp(-(wx*wx + wy*wy) / (2*sigma*sigma));
+        }
+    }
+    std::vector<double> energy(n, 0.0);
+    std::vector<char> on(n, 0);
+    auto splat = [&](int p, double sign) {
+        int px = p % size, py = p / size;
+        for (int qy = 0; qy < size; qy++) {
+            const double *row = &kernel[((qy - py + size) % size) * size];
+            for (int qx = 0; qx < size; qx++)
+                energy[qy*size + qx] += sign * row[(qx - px + size) % size];
+        }
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++)
+            if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; p++)
+            if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+        return best;
+    };
+
+    // a random initial pattern, relaxed until moving its tightest point no longer helps
+    pcg32 rng(seed, 0x9e3779b97f4a7c15ULL);
+    int ones = 0;
+    while (ones < n/10) {
+        int p = int(rng.next_uint() % uint32_t(n));
+        if (!on[p]) { on[p] = 1; splat(p, 1); ones++; }
+    }
+    for (int iter = 0; iter < n; iter++) {
+        int c = tightest_cluster();
+        on[c] = 0; splat(c, -1);
+        int v = largest_void();
+        on[v] = 1; splat(v, 1);
+        if (v == c) break;
+    }
+
+    // Ranks below the initial pattern come from removing clusters; the rest from filling voids.
+    // Past half full, the largest void among zeros is also their tightest cluster, so one rule
+    // covers both of Ulichney's later phases.
+    std::vector<int> rank(n);
+    std::vector<double> saved_energy = energy;
+    std::vector<char> saved_on = on;
+    for (int r = ones - 1; r >= 0; r--) {
+        int c = tightest_cluster();
+        on[c] = 0; splat(c, -1);
+        rank[c] = r;
+    }
+    energy.swap(saved_energy);
+    on.swap(saved_on);
+    for (int r = ones; r < n; r++) {
+        int v = largest_void();
+        on[v] = 1; splat(v, 1);
+        rank[v] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int p = 0; p < n; p++)
+        mask[p] = (rank[p] + 0.5f) / n;
+    return mask;
+}
+
+
+// One scrambled Sobol sequence shared by every pixel, shifted per pixel by a blue-noise mask
+// (Georgiev and Fajardo, "Blue-noise Dithered Sampling", 2016). Per pixel the samples are as
+// well stratified as sobol_sampler's, and the leftover error between neighbouring pixels is
+// pushed to high frequencies, where it reads as fine grain rather than blotches.
+class blue_noise_sampler : public sampler {
+    public:
+        static const int mask_size = 64;
+
+        blue_noise_sampler() : mask(make_blue_noise_mask(mask_size, 1)) {}
+
+        virtual void sample_2d(int x, int y, uint32_t index, uint32_t frame, int pair, double out[2]) const {
+            uint32_t seed = sample_seed(0, pair, frame);
+            double base[2];
+            sobol_2d(index, seed, base);
+            for (int k = 0; k < 2; k++) {
+                // a different toroidal offset into the mask for every dimension
+                uint32_t h = owen_scramble(seed, 2 + k);
+                int mx = (x + int(h & 0xffff)) & (mask_size - 1);
+                int my = (y + int(h >> 16)) & (mask_size - 1);
+                double v = base[k] + mask[my*mask_size + mx];
+                out[k] = v >= 1 ? v - 1 : v;
+            }
+        }
+
+        std::vector<float> mask;
+};
+
+
+enum sampler_type { sampler_random, sampler_halton, sampler_sobol, sampler_blue_noise };
+
+
+// Returns false for an unknown name.
+bool parse_sampler_type(const char *name, sampler_type& type) {
+    if (!strcmp(name, "random")) type = sampler_random;
+    else if (!strcmp(name, "halton")) type = sampler_halton;
+    else if (!strcmp(name, "sobol")) type = sampler_sobol;
+    else if (!strcmp(name, "bluenoise")) type = sampler_blue_noise;
+    else return false;
+    return true;
+}
+
+
+// Samplers hold no per-render state, so one shared instance of each serves every thread. Null
+// for sampler_random, which keeps the original independent draws and rejection loops.
+const sampler *get_sampler(sampler_type type) {
+    switch (type) {
+        case sampler_random: return 0;
+        case sampler_halton: { static const halton_sampler s; return &s; }
+        case sampler_sobol: { static const sobol_sampler s; return &s; }
+        case sampler_blue_noise: { static const blue_noise_sampler s; return &s; }
+    }
+    return 0;
+}
+
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef SCENEH
+#define SCENEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "camera.h"
+#include "hitable_list.h"
+#include "material.h"
+#include "random.h"
+#include "sphere.h"
+#include "sphere_set.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SCENE_MMAP 1
+#endif
+
+
+// Plain-old-data scene tables. The binary scene file stores these structs verbatim, so a mapped
+// file can be used in place.
+
+enum scene_material_type { scene_lambertian = 0, scene_metal = 1, scene_dielectric = 2 };
+
+struct scene_material {
+    int32_t type;
+    float albedo[3];
+    float param;        // fuzz for metal, refractive index for dielectric
+};
+
+struct scene_sphere {
+    float center[3];
+    float radius;
+    int32_t material;
+};
+
+// A placement of a mesh: scaled, then turned about y, then moved. Text scenes only.
+struct scene_instance {
+    int32_t mesh;
+    int32_t material;
+    float translate[3];
+    float rotate_y;     // degrees
+    float scale;
+};
+
+struct scene_camera {
+    float lookfrom[3];
+    float lookat[3];
+    float vup[3];
+    float vfov;
+    float aperture;
+    float focus_dist;
+};
+
+
+camera make_camera(const scene_camera& c, real aspect) {
+    return camera(vec3(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]),
+                  vec3(c.lookat[0], c.lookat[1], c.lookat[2]),
+                  vec3(c.vup[0], c.vup[1], c.vup[2]),
+                  c.vfov, aspect, c.aperture, c.focus_dist);
+}
+
+
+// A view of a scene's tables, either owned (built in code or parsed from text) or pointing into a
+// mapped binary file.
+class scene_description {
+    public:
+        scene_description() : materials(0), spheres(0), num_materials(0), num_spheres(0) {}
+        ~scene_description() {
+#ifdef SCENE_MMAP
+            if (mapping) munmap(mapping, mapping_size);
+#endif
+        }
+
+        int add_material(const scene_material& m) {
+            owned_materials.push_back(m);
+            materials = owned_materials.data();
+            num_materials = owned_materials.size();
+            return int(num_materials - 1);
+        }
+        void add_sphere(const vec3& c, float r, int material) {
+            scene_sphere s = { { float(c.x()), float(c.y()), float(c.z()) }, r, material };
+            owned_spheres.push_back(s);
+            spheres = owned_spheres.data();
+            num_spheres = owned_spheres.size();
+        }
+
+        camera make_camera(float aspect) const { return ::make_camera(cam, aspect); }
+
+        scene_camera cam;
+        const scene_material *materials;
+        const scene_sphere *spheres;
+        size_t num_materials;
+        size_t num_spheres;
+
+        std::vector<scene_material> owned_materials;
+        std::vector<scene_sphere> owned_spheres;
+        std::vector<std::string> meshes;        // OBJ paths, resolved against the scene file's directory
+        std::vector<scene_instance> instances;
+        std::vector<char> owned_file;   // file contents when mmap is unavailable
+        void *mapping = 0;
+        size_t mapping_size = 0;
+
+    private:
+        scene_description(const scene_description&);
+        scene_description& operator=(const scene_description&);
+};
+
+
+scene_material make_scene_material(int type, const vec3& albedo, float param) {
+    scene_material m = { type, { float(albedo.x()), float(albedo.y()), float(albedo.z()) }, param };
+    return m;
+}
+
+
+// The book's final scene: a (2n)x(2n) grid of small random spheres around three large ones. n = 11
+// gives the original ~490 spheres; larger n gives scaled versions of the same scene.
+void random_scene(scene_description& scene, int n = 11) {
+    scene_camera cam = { {13,2,3}, {0,0,0}, {0,1,0}, 20, 0.1f, 10.0f };
+    scene.cam = cam;
+    scene.add_sphere(vec3(0,-1000,0), 1000, scene.add_material(make_scene_material(scene_lambertian, vec3(0.5, 0.5, 0.5), 0)));
+    for (int a = -n; a < n; a++) {
+        for (int b = -n; b < n; b++) {
+            float choose_mat = random_double();
+            vec3 center(a+0.9*random_double(),0.2,b+0.9*random_double());
+            if ((center-vec3(4,0.2,0)).length() > 0.9) {
+                int m;
+                if (choose_mat < 0.8) {  // diffuse
+                    m = scene.add_material(make_scene_material(scene_lambertian,
+                                           vec3(random_double()*random_double(),
+                                                random_double()*random_double(),
+                                                random_double()*random_double()), 0));
+                }
+                else if (choose_mat < 0.95) { // metal
+                    m = scene.add_material(make_scene_material(scene_metal,
+                                           vec3(0.5*(1 + random_double()),
+                                                0.5*(1 + random_double()),
+                                                0.5*(1 + random_double())),
+                                           0.5*random_double()));
+                }
+                else {  // glass
+                    m = scene.add_material(make_scene_material(scene_dielectric, vec3(1,1,1), 1.5));
+                }
+                scene.add_sphere(center, 0.2, m);
+            }
+        }
+    }
+
+    scene.add_sphere(vec3(0, 1, 0), 1.0, scene.add_material(make_scene_material(scene_dielectric, vec3(1,1,1), 1.5)));
+    scene.add_sphere(vec3(-4, 1, 0), 1.0, scene.add_material(make_scene_material(scene_lambertian, vec3(0.4, 0.2, 0.1), 0)));
+    scene.add_sphere(vec3(4, 1, 0), 1.0, scene.add_material(make_scene_material(scene_metal, vec3(0.7, 0.6, 0.5), 0.0)));
+}
+
+
+// Text form, one record per line, '#' starts a comment. Materials are numbered in the order they
+// appear and spheres refer to them by that number:
+//     camera <lookfrom x y z> <lookat x y z> <vup x y z> <vfov> <aperture> <focus_dist>
+//     lambertian <r g b>
+//     metal <r g b> <fuzz>
+//     dielectric <ref_idx>
+//     sphere <x y z> <radius> <material>
+//     mesh <obj path>
+//     instance <mesh> <material> <x y z> [<rotate_y degrees> [<scale>]]
+// Meshes are numbered like materials; relative paths are taken from the scene file's directory.
+// An instance's scale must be positive.
+bool read_scene_text(const char *path, scene_description& scene, std::string& error) {
+    std::ifstream in(path);
+    if (!in) { error = "cannot open " + std::string(path); return false; }
+    std::string line;
+    int line_no = 0;
+    bool have_camera = false;
+    while (std::getline(in, line)) {
+        line_no++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream ls(line);
+        std::string kind;
+        if (!(ls >> kind)) continue;
+        bool ok = true;
+        if (kind == "camera") {
+            scene_camera& c = scene.cam;
+            ok = bool(ls >> c.lookfrom[0] >> c.lookfrom[1] >> c.lookfrom[2]
+                         >> c.lookat[0] >> c.lookat[1] >> c.lookat[2]
+                         >> c.vup[0] >> c.vup[1] >> c.vup[2]
+                         >> c.vfov >> c.aperture >> c.focus_dist);
+            have_camera = true;
+        }
+        else if (kind == "lambertian" || kind == "metal" || kind == "dielectric") {
+            vec3 albedo(1,1,1);
+            float param = 0;
+            if (kind == "lambertian") ok = bool(ls >> albedo);
+            else if (kind == "metal") ok = bool(ls >> albedo >> param);
+            else ok = bool(ls >> param);
+            int type = kind == "lambertian" ? scene_lambertian : kind == "metal" ? scene_metal : scene_dielectric;
+            scene.add_material(make_scene_material(type, albedo, param));
+        }
+        else if (kind == "sphere") {
+            vec3 c;
+            float r;
+            int m;
+            ok = bool(ls >> c >> r >> m) && m >= 0 && size_t(m) < scene.num_materials;
+            if (ok) scene.add_sphere(c, r, m);
+        }
+        else if (kind == "mesh") {
+            std::string file;
+            ok = bool(ls >> file);
+            std::string dir(path);
+            size_t slash = dir.rfind('/');
+            if (ok && file[0] != '/' && slash != std::string::npos)
+                file = dir.substr(0, slash + 1) + file;
+            scene.meshes.push_back(file);
+        }
+        else if (kind == "instance") {
+            scene_instance inst = { 0, 0, { 0, 0, 0 }, 0, 1 };
+            ok = bool(ls >> inst.mesh >> inst.material >> inst.translate[0] >> inst.translate[1] >> inst.translate[2])
+                 && inst.mesh >= 0 && size_t(inst.mesh) < scene.meshes.size()
+                 && inst.material >= 0 && size_t(inst.material) < scene.num_materials;
+            if (ok && ls >> inst.rotate_y) ls >> inst.scale;
+            // the instance's inverse transform divides by the scale
+            ok = ok && isfinite(inst.scale) && inst.scale > 0;
+            scene.instances.push_back(inst);
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            error = std::string(path) + ":" + std::to_string(line_no) + ": bad " + kind + " record";
+            return false;
+        }
+    }
+    if (!have_camera) { error = std::string(path) + ": no camera"; return false; }
+    return true;
+}
+
+
+bool write_scene_text(const char *path, const scene_description& scene) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    const scene_camera& c = scene.cam;
+    fprintf(f, "camera %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g\n",
+            c.lookfrom[0], c.lookfrom[1], c.lookfrom[2], c.lookat[0], c.lookat[1], c.lookat[2],
+            c.vup[0], c.vup[1], c.vup[2], c.vfov, c.aperture, c.focus_dist);
+    for (size_t i = 0; i < scene.num_materials; i++) {
+        const scene_material& m = scene.materials[i];
+        if (m.type == scene_lambertian)
+            fprintf(f, "lambertian %.9g %.9g %.9g\n", m.albedo[0], m.albedo[1], m.albedo[2]);
+        else if (m.type == scene_metal)
+            fprintf(f, "metal %.9g %.9g %.9g %.9g\n", m.albedo[0], m.albedo[1], m.albedo[2], m.param);
+        else
+            fprintf(f, "dielectric %.9g\n", m.param);
+    }
+    for (size_t i = 0; i < scene.num_spheres; i++) {
+        const scene_sphere& s = scene.spheres[i];
+        fprintf(f, "sphere %.9g %.9g %.9g %.9g %d\n", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+    }
+    for (const std::string& m : scene.meshes)
+        fprintf(f, "mesh %s\n", m.c_str());
+    for (const scene_instance& i : scene.instances)
+        fprintf(f, "instance %d %d %.9g %.9g %.9g %.9g %.9g\n", i.mesh, i.material,
+                i.translate[0], i.translate[1], i.translate[2], i.rotate_y, i.scale);
+    return fclose(f) == 0;
+}
+
+
+// Binary form: this header, then the material table and the sphere table, each starting on a
+// 64-byte boundary. Native endianness. The magic is bytes and reads the same either way; it is
+// the version field that shows a file from the other byte order, as 0x01000000.
+struct scene_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_materials;
+    uint64_t num_spheres;
+    scene_camera cam;
+    uint64_t materials_offset;
+    uint64_t spheres_offset;
+};
+
+static const char scene_magic[8] = { 'R','T','S','C','E','N','E','1' };
+
+
+inline uint64_t align64(uint64_t x) { return (x + 63) & ~uint64_t(63); }
+
+
+scene_file_header make_scene_header(const scene_description& scene) {
+    scene_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, scene_magic, 8);
+    h.version = 1;
+    h.num_materials = uint32_t(scene.num_materials);
+    h.num_spheres = scene.num_spheres;
+    h.cam = scene.cam;
+    h.materials_offset = align64(sizeof(h));
+    h.spheres_offset = align64(h.materials_offset + scene.num_materials*sizeof(scene_material));
+    return h;
+}
+
+
+// Fails for scenes with meshes, which the binary form does not carry.
+bool write_scene_binary(const char *path, const scene_description& scene) {
+    if (!scene.meshes.empty()) return false;
+    scene_file_header h = make_scene_header(scene);
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    static const char zeros[64] = {0};
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+           && fwrite(zeros, 1, h.materials_offset - sizeof(h), f) == h.materials_offset - sizeof(h)
+           && fwrite(scene.materials, sizeof(scene_material), scene.num_materials, f) == scene.num_materials;
+    uint64_t end = h.materials_offset + scene.num_materials*sizeof(scene_material);
+    ok = ok && fwrite(zeros, 1, h.spheres_offset - end, f) == h.spheres_offset - end
+            && fwrite(scene.spheres, sizeof(scene_sphere), scene.num_spheres, f) == scene.num_spheres;
+    return (fclose(f) == 0) && ok;
+}
+
+
+// The binary form in memory, for shipping a scene to another process.
+std::vector<char> scene_to_binary(const scene_description& scene) {
+    scene_file_header h = make_scene_header(scene);
+    std::vector<char> bytes(h.spheres_offset + scene.num_spheres*sizeof(scene_sphere), 0);
+    memcpy(&bytes[0], &h, sizeof(h));
+    if (scene.num_materials)
+        memcpy(&bytes[h.materials_offset], scene.materials, scene.num_materials*sizeof(scene_material));
+    if (scene.num_spheres)
+        memcpy(&bytes[h.spheres_offset], scene.spheres, scene.num_spheres*sizeof(scene_sphere));
+    return bytes;
+}
+
+
+// FNV-1a over everything that decides the rendered image: camera, tables, mesh paths and
+// instances. Equal scenes hash equal whether they were built, parsed or mapped.
+uint64_t scene_hash(const scene_description& scene) {
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](const void *data, size_t n) {
+        const unsigned char *p = (const unsigned char*)data;
+        for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+    };
+    uint64_t counts[4] = { scene.num_materials, scene.num_spheres, scene.meshes.size(), scene.instances.size() };
+    mix(counts, sizeof(counts));
+    mix(&scene.cam, sizeof(scene.cam));
+    mix(scene.materials, scene.num_materials*sizeof(scene_material));
+    mix(scene.spheres, scene.num_spheres*sizeof(scene_sphere));
+    for (const std::string& m : scene.meshes) mix(m.c_str(), m.size() + 1);
+    mix(scene.instances.data(), scene.instances.size()*sizeof(scene_instance));
+    return h;
+}
+
+
+// Checks the header and tables of a binary scene image and points the scene's tables into it.
+// The image may come from an untrusted file or socket, so every offset, count and material index
+// is checked before anything reads through it.
+bool attach_scene_tables(const char *base, size_t size, scene_description& scene, const std::string& name,
+                         std::string& error) {
+    if (size < sizeof(scene_file_header)) { error = name + ": truncated scene"; return false; }
+    scene_file_header h;
+    memcpy(&h, base, sizeof(h));
+    if (!memcmp(h.magic, scene_magic, 8) && h.version == 0x01000000) {
+        error = name + ": scene file was written with the other byte order";
+        return false;
+    }
+    if (memcmp(h.magic, scene_magic, 8) || h.version != 1) {
+        error = name + ": not a version 1 scene file";
+        return false;
+    }
+    // written as offset <= size && count <= (size - offset)/item so no term can wrap
+    if (h.materials_offset > size || h.num_materials > (size - h.materials_offset) / sizeof(scene_material)
+        || h.spheres_offset > size || h.num_spheres > (size - h.spheres_offset) / sizeof(scene_sphere)
+        || h.materials_offset % 64 || h.spheres_offset % 64) {
+        error = name + ": truncated scene";
+        return false;
+    }
+    const scene_material *materials = reinterpret_cast<const scene_material*>(base + h.materials_offset);
+    const scene_sphere *spheres = reinterpret_cast<const scene_sphere*>(base + h.spheres_offset);
+    for (uint32_t i = 0; i < h.num_materials; i++) {
+        if (materials[i].type < scene_lambertian || materials[i].type > scene_dielectric) {
+            error = name + ": material " + std::to_string(i) + " has an unknown type";
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < h.num_spheres; i++) {
+        if (spheres[i].material < 0 || uint32_t(spheres[i].material) >= h.num_materials) {
+            error = name + ": sphere " + std::to_string(i) + " uses a missing material";
+            return false;
+        }
+    }
+    scene.cam = h.cam;
+    scene.materials = materials;
+    scene.num_materials = h.num_materials;
+    scene.spheres = spheres;
+    scene.num_spheres = h.num_spheres;
+    return true;
+}
+
+
+// Takes ownership of a binary scene image received from elsewhere.
+bool read_scene_memory(std::vector<char>& bytes, scene_description& scene, std::string& error) {
+    scene.owned_file.swap(bytes);
+    return attach_scene_tables(scene.owned_file.data(), scene.owned_file.size(), scene, "scene", error);
+}
+
+
+bool is_binary_scene(const char *path) {
+    char magic[8];
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    bool yes = fread(magic, 1, 8, f) == 8 && !memcmp(magic, scene_magic, 8);
+    fclose(f);
+    return yes;
+}
+
+
+// Maps the file and points the tables straight into it; nothing is parsed or copied beyond the
+// header check, so load time is the page faults taken when the tables are first read.
+bool read_scene_binary(const char *path, scene_description& scene, std::string& error) {
+    const char *base;
+    size_t size;
+#ifdef SCENE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { error = "cannot open " + std::string(path); return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(scene_file_header))) {
+        close(fd);
+        error = std::string(path) + ": truncated scene";
+        return false;
+    }
+    size = size_t(st.st_size);
+    void *m = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { error = "cannot map " + std::string(path); return false; }
+    scene.mapping = m;
+    scene.mapping_size = size;
+    base = static_cast<const char*>(m);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) { error = "cannot open " + std::string(path); return false; }
+    scene.owned_file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    size = scene.owned_file.size();
+    base = scene.owned_file.data();
+#endif
+    if (!attach_scene_tables(base, size, scene, path, error))
+        return false;
+#ifdef SCENE_MMAP
+    madvise(scene.mapping, size, MADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+
+bool read_scene(const char *path, scene_description& scene, std::string& error) {
+    if (is_binary_scene(path))
+        return read_scene_binary(path, scene, error);
+    return read_scene_text(path, scene, error);
+}
+
+
+// Materials and spheres are placed in an arena owned by the caller, so a scene's objects are
+// contiguous and freed together. Materials are addressed by their index in the returned table,
+// which is the index the scene tables already use. sphere_set stores that index, and the compact
+// set an index into its palette. The virtual sphere still stores a material*: hit() fills
+// hit_record::mat_ptr and has no table to look an index up in, and a table pointer would take the
+// same eight bytes.
+std::vector<material*> make_materials(const scene_description& scene, arena& mem) {
+    std::vector<material*> mats(scene.num_materials);
+    for (size_t i = 0; i < scene.num_materials; i++) {
+        const scene_material& m = scene.materials[i];
+        vec3 albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        if (m.type == scene_lambertian) mats[i] = mem.create<lambertian>(albedo);
+        else if (m.type == scene_metal) mats[i] = mem.create<metal>(albedo, m.param);
+        else mats[i] = mem.create<dielectric>(m.param);
+    }
+    return mats;
+}
+
+
+hitable_list *make_hitable_list(const scene_description& scene, const std::vector<material*>& mats, arena& mem) {
+    hitable **list = mem.create_array<hitable*>(scene.num_spheres);
+    sphere *spheres = mem.create_array<sphere>(scene.num_spheres);
+    for (size_t i = 0; i < scene.num_spheres; i++) {
+        const scene_sphere& s = scene.spheres[i];
+        spheres[i] = sphere(vec3(s.center[0], s.center[1], s.center[2]), s.radius, mats[s.material]);
+        list[i] = &spheres[i];
+    }
+    return mem.create<hitable_list>(list, int(scene.num_spheres));
+}
+
+
+// Straight from the sphere table into the packed arrays the SIMD kernels read.
+sphere_set *make_sphere_set(const scene_description& scene, const std::vector<material*>& mats) {
+    sphere_set *set = new sphere_set();
+    set->materials = mats;
+    set->reserve(scene.num_spheres);
+    for (size_t i = 0; i < scene.num_spheres; i++) {
+        const scene_sphere& s = scene.spheres[i];
+        set->add(vec3(s.center[0], s.center[1], s.center[2]), s.radius, int(s.material));
+    }
+    set->build();
+    return set;
+}
+
+
+#endif
@@ -12,27 +12,30 @@
 //==================================================================================================
 
 #include "hitable.h"
+#include "instrument.h"
 
 
 class sphere: public hitable  {
     public:
         sphere() {}
-        sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m)  {};
-        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        sphere(vec3 cen, real r, material *m) : center(cen), radius(r), mat_ptr(m)  {};
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
         vec3 center;
-        float radius;
+        real radius;
         material *mat_ptr;
 };
 
 
-bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RT_COUNT(primitive_tests);
     vec3 oc = r.origin() - center;
-    float a = dot(r.direction(), r.direction());
-    float b = dot(oc, r.direction());
-    float c = dot(oc, oc) - radius*radius;
-    float discriminant = b*b - a*c;
+    real a = dot(r.direction(), r.direction());
+    real b = dot(oc, r.direction());
+    real c = dot(oc, oc) - radius*radius;
+    real discriminant = b*b - a*c;
     if (discriminant > 0) {
-        float temp = (-b - sqrt(discriminant))/a;
+        real temp = (-b - sqrt(discriminant))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
@@ -53,4 +56,10 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 }
 
 
+bool sphere::bounding_box(aabb& box) const {
+    box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
+    return true;
+}
+
+
 #endif
@@ -0,0 +1,376 @@
+#ifndef SPHERESETH
+#define SPHERESETH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <limits>
+#include <unordered_map>
+#include "aligned_allocator.h"
+#include "bvh.h"
+#include "hitable.h"
+#include "instrument.h"
+
+// The vector kernels are single precision; double builds use hit_range_scalar().
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(RT_DOUBLE_PRECISION)
+#define SPHERESET_X86 1
+#include <immintrin.h>
+#endif
+
+
+// Spheres stored as structure-of-arrays and intersected several at a time. The arithmetic in
+// every kernel follows sphere::hit operation for operation, so hits match it bit for bit. Spheres
+// are kept in BVH leaf order and each leaf is tested by one call to hit_range().
+class sphere_set : public hitable {
+    public:
+        static const int simd_width = 8;
+        static const int leaf_size = 8;
+
+        sphere_set() {}
+        void add(const vec3& center, real radius, material *m);
+        // For callers that fill materials themselves and refer to it by index.
+        void add(const vec3& center, real radius, int material_index);
+        void reserve(size_t n);
+        // Sorts the spheres into BVH leaf order; order, if given, receives each new position's
+        // index in the order the spheres were added.
+        void build(std::vector<int> *order = 0);
+
+        // Edits for scenes that change between renders, none of which rebuilds the tree. insert()
+        // adds the sphere to the leaf whose box grows least and returns its position, which
+        // shifts every later sphere up by one, or -1 if there is no tree or the leaf is full;
+        // erase() leaves a NaN center that no ray can hit. Moves write cx, cy, cz and radius
+        // directly. refit() must follow any of them before the next hit().
+        int insert(const vec3& center, real radius, int material_index);
+        void erase(int i);
+        void refit();
+        bool live(int i) const { return cx[i] == cx[i]; }
+        virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+
+        // hit() without the virtual call, also reporting the hit sphere's material index and,
+        // if asked, its position.
+        bool hit_indexed(const ray& r, real tmin, real tmax, hit_record& rec, int& material,
+                         int *index = 0) const;
+
+        // Fills rec for r's hit on sphere i at t, as hit() would.
+        void hit_record_at(const ray& r, int i, real t, hit_record& rec) const;
+
+        // Tests spheres [first, first+count) and returns the index of the nearest hit in
+        // (t_min, closest), lowering closest to it, or -1 if there is none.
+        int hit_range(const ray& r, int first, int count, real t_min, real& closest) const;
+        int hit_range_scalar(const ray& r, int first, int count, real t_min, real& closest) const;
+#ifdef SPHERESET_X86
+        int hit_range_sse(const ray& r, int first, int count, real t_min, real& closest) const;
+        __attribute__((target("avx2")))
+        int hit_range_avx2(const ray& r, int first, int count, real t_min, real& closest) const;
+#endif
+
+        int size() const { return num_spheres; }
+
+        int num_spheres = 0;
+        aligned_vector<real> cx, cy, cz, radius;   // padded with simd_width zeros
+        std::vector<int> mat_index;
+        std::vector<material*> materials;
+        std::unordered_map<material*, int> material_ids;
+        bvh_tree tree;
+        bool use_avx2 = false;
+};
+
+
+void sphere_set::add(const vec3& center, real r, material *m) {
+    auto found = material_ids.find(m);
+    int id;
+    if (found == material_ids.end()) {
+        id = int(materials.size());
+        materials.push_back(m);
+        material_ids[m] = id;
+    }
+    else {
+        id = found->second;
+    }
+    add(center, r, id);
+}
+
+
+// After build() the new sphere goes before the padding and stays out of the tree until the next
+// build().
+void sphere_set::add(const vec3& center, real r, int material_index) {
+    cx.insert(cx.begin() + num_spheres, real(center.x()));
+    cy.insert(cy.begin() + num_spheres, real(center.y()));
+    cz.insert(cz.begin() + num_spheres, real(center.z()));
+    radius.insert(radius.begin() + num_spheres, r);
+    mat_index.insert(mat_index.begin() + num_spheres, material_index);
+    num_spheres++;
+}
+
+
+void sphere_set::reserve(size_t n) {
+    cx.reserve(n); cy.reserve(n); cz.reserve(n); radius.reserve(n);
+    mat_index.reserve(n);
+}
+
+
+void sphere_set::build(std::vector<int> *order) {
+    std::vector<aabb> boxes(num_spheres);
+    for (int i = 0; i < num_spheres; i++) {
+        vec3 c(cx[i], cy[i], cz[i]);
+        vec3 rr(radius[i], radius[i], radius[i]);
+        boxes[i] = aabb(c - rr, c + rr);
+    }
+    tree.build(boxes, leaf_size);
+
+    aligned_vector<real> ncx(num_spheres + simd_width, 0.0f), ncy(ncx), ncz(ncx), nr(ncx);
+    std::vector<int> nmat(num_spheres);
+    if (order) order->assign(tree.order.begin(), tree.order.end());
+    for (int i = 0; i < num_spheres; i++) {
+        int p = tree.order[i];
+        ncx[i] = cx[p]; ncy[i] = cy[p]; ncz[i] = cz[p]; nr[i] = radius[p];
+        nmat[i] = mat_index[p];
+        tree.order[i] = i;
+    }
+    cx.swap(ncx); cy.swap(ncy); cz.swap(ncz); radius.swap(nr);
+    mat_index.swap(nmat);
+
+#ifdef SPHERESET_X86
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+inline bool sphere_set::hit_indexed(const ray& r, real t_min, real t_max, hit_record& rec,
+                                    int& material, int *index) const {
+    int best = -1;
+    real best_t = t_max;
+    tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest_so_far) {
+        int i = hit_range(r, first, count, t_min, closest_so_far);
+        if (i < 0) return false;
+        best = i;
+        best_t = closest_so_far;
+        return true;
+    });
+    if (best < 0) return false;
+    hit_record_at(r, best, best_t, rec);
+    material = mat_index[best];
+    if (index) *index = best;
+    return true;
+}
+
+
+inline void sphere_set::hit_record_at(const ray& r, int i, real t, hit_record& rec) const {
+    vec3 center(cx[i], cy[i], cz[i]);
+    rec.t = t;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius[i];
+    rec.mat_ptr = materials[mat_index[i]];
+}
+
+
+int sphere_set::insert(const vec3& center, real r, int material_index) {
+    if (tree.nodes.empty()) return -1;
+    aabb box(center - vec3(r, r, r), center + vec3(r, r, r));
+    int node = 0;
+    while (tree.nodes[node].count == 0) {
+        const aabb& b1 = tree.nodes[node+1].box;
+        const aabb& b2 = tree.nodes[tree.nodes[node].offset].box;
+        real grow1 = surrounding_box(b1, box).surface_area() - b1.surface_area();
+        real grow2 = surrounding_box(b2, box).surface_area() - b2.surface_area();
+        node = grow1 <= grow2 ? node+1 : tree.nodes[node].offset;
+    }
+    if (tree.nodes[node].count == 65535) return -1;
+    int pos = tree.nodes[node].offset + tree.nodes[node].count;
+    cx.insert(cx.begin() + pos, real(center.x()));
+    cy.insert(cy.begin() + pos, real(center.y()));
+    cz.insert(cz.begin() + pos, real(center.z()));
+    radius.insert(radius.begin() + pos, r);
+    mat_index.insert(mat_index.begin() + pos, material_index);
+    tree.order.push_back(num_spheres);
+    num_spheres++;
+    for (size_t i = 0; i < tree.nodes.size(); i++)
+        if (tree.nodes[i].count > 0 && tree.nodes[i].offset >= pos && int(i) != node)
+            tree.nodes[i].offset++;
+    tree.nodes[node].count++;
+    return pos;
+}
+
+
+void sphere_set::erase(int i) {
+    cx[i] = cy[i] = cz[i] = std::numeric_limits<real>::quiet_NaN();
+}
+
+
+void sphere_set::refit() {
+    tree.refit([&](int first, int count) {
+        const real inf = std::numeric_limits<real>::infinity();
+        aabb box(vec3(inf, inf, inf), vec3(-inf, -inf, -inf));
+        for (int i = first; i < first + count; i++) {
+            if (!live(i)) continue;
+            vec3 c(cx[i], cy[i], cz[i]);
+            vec3 rr(radius[i], radius[i], radius[i]);
+            box = surrounding_box(box, aabb(c - rr, c + rr));
+        }
+        return box;
+    });
+}
+
+
+bool sphere_set::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    int material;
+    return hit_indexed(r, t_min, t_max, rec, material);
+}
+
+
+bool sphere_set::bounding_box(aabb& box) const {
+    if (tree.nodes.empty()) return false;
+    box = tree.nodes[0].box;
+    return true;
+}
+
+
+int sphere_set::hit_range(const ray& r, int first, int count, real t_min, real& closest) const {
+    RT_COUNT_N(primitive_tests, count);
+#ifdef SPHERESET_X86
+    if (use_avx2)
+        return hit_range_avx2(r, first, count, t_min, closest);
+    return hit_range_sse(r, first, count, t_min, closest);
+#else
+    return hit_range_scalar(r, first, count, t_min, closest);
+#endif
+}
+
+
+int sphere_set::hit_range_scalar(const ray& r, int first, int count, real t_min, real& closest) const {
+    int best = -1;
+    for (int i = first; i < first + count; i++) {
+        vec3 oc = r.origin() - vec3(cx[i], cy[i], cz[i]);
+        real a = dot(r.direction(), r.direction());
+        real b = dot(oc, r.direction());
+        real c = dot(oc, oc) - radius[i]*radius[i];
+        real discriminant = b*b - a*c;
+        if (discriminant > 0) {
+            real temp = (-b - sqrt(discriminant))/a;
+            if (temp < closest && temp > t_min) {
+                closest = temp;
+                best = i;
+                continue;
+            }
+            temp = (-b + sqrt(discriminant)) / a;
+            if (temp < closest && temp > t_min) {
+                closest = temp;
+                best = i;
+            }
+        }
+    }
+    return best;
+}
+
+
+#ifdef SPHERESET_X86
+
+int sphere_set::hit_range_sse(const ray& r, int first, int count, float t_min, float& closest) const {
+    const vec3& o = r.A;
+    const vec3& d = r.B;
+    float a_s = dot(d, d);
+    __m128 ox = _mm_set1_ps(o.x()), oy = _mm_set1_ps(o.y()), oz = _mm_set1_ps(o.z());
+    __m128 dx = _mm_set1_ps(d.x()), dy = _mm_set1_ps(d.y()), dz = _mm_set1_ps(d.z());
+    __m128 a = _mm_set1_ps(a_s);
+    __m128 tmin = _mm_set1_ps(t_min);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 inf = _mm_set1_ps(FLT_MAX);
+    __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    int best = -1;
+    for (int i = first; i < first + count; i += 4) {
+        __m128 tmax = _mm_set1_ps(closest);
+        __m128 valid = _mm_cmplt_ps(lane, _mm_set1_ps(float(first + count - i)));
+        __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&cx[i]));
+        __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&cy[i]));
+        __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&cz[i]));
+        __m128 rad = _mm_loadu_ps(&radius[i]);
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)),
+                                         _mm_mul_ps(ocz, ocz)),
+                              _mm_mul_ps(rad, rad));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+        valid = _mm_and_ps(valid, _mm_cmpgt_ps(disc, _mm_setzero_ps()));
+        if (!_mm_movemask_ps(valid)) continue;
+        __m128 sq = _mm_sqrt_ps(disc);
+        __m128 nb = _mm_xor_ps(b, sign);
+        __m128 t1 = _mm_div_ps(_mm_sub_ps(nb, sq), a);
+        __m128 t2 = _mm_div_ps(_mm_add_ps(nb, sq), a);
+        __m128 ok1 = _mm_and_ps(valid, _mm_and_ps(_mm_cmplt_ps(t1, tmax), _mm_cmpgt_ps(t1, tmin)));
+        __m128 ok2 = _mm_andnot_ps(ok1, _mm_and_ps(valid, _mm_and_ps(_mm_cmplt_ps(t2, tmax), _mm_cmpgt_ps(t2, tmin))));
+        int any = _mm_movemask_ps(_mm_or_ps(ok1, ok2));
+        if (!any) continue;
+        __m128 t = _mm_or_ps(_mm_and_ps(ok1, t1), _mm_and_ps(ok2, t2));
+        t = _mm_or_ps(t, _mm_andnot_ps(_mm_or_ps(ok1, ok2), inf));
+        __m128 m = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        int lanes = _mm_movemask_ps(_mm_cmpeq_ps(t, m)) & any;
+        closest = _mm_cvtss_f32(m);
+        best = i + __builtin_ctz(lanes);
+    }
+    return best;
+}
+
+
+__attribute__((target("avx2")))
+int sphere_set::hit_range_avx2(const ray& r, int first, int count, float t_min, float& closest) const {
+    const vec3& o = r.A;
+    const vec3& d = r.B;
+    float a_s = dot(d, d);
+    __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()), oz = _mm256_set1_ps(o.z());
+    __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+    __m256 a = _mm256_set1_ps(a_s);
+    __m256 tmin = _mm256_set1_ps(t_min);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 inf = _mm256_set1_ps(FLT_MAX);
+    __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    int best = -1;
+    for (int i = first; i < first + count; i += 8) {
+        __m256 tmax = _mm256_set1_ps(closest);
+        __m256 valid = _mm256_cmp_ps(lane, _mm256_set1_ps(float(first + count - i)), _CMP_LT_OQ);
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&cx[i]));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&cy[i]));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&cz[i]));
+        __m256 rad = _mm256_loadu_ps(&radius[i]);
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                                 _mm256_mul_ps(ocz, dz));
+        __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                               _mm256_mul_ps(ocz, ocz)),
+                                 _mm256_mul_ps(rad, rad));
+        __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GT_OQ));
+        if (!_mm256_movemask_ps(valid)) continue;
+        __m256 sq = _mm256_sqrt_ps(disc);
+        __m256 nb = _mm256_xor_ps(b, sign);
+        __m256 t1 = _mm256_div_ps(_mm256_sub_ps(nb, sq), a);
+        __m256 t2 = _mm256_div_ps(_mm256_add_ps(nb, sq), a);
+        __m256 ok1 = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t1, tmax, _CMP_LT_OQ),
+                                                        _mm256_cmp_ps(t1, tmin, _CMP_GT_OQ)));
+        __m256 ok2 = _mm256_andnot_ps(ok1, _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t2, tmax, _CMP_LT_OQ),
+                                                                            _mm256_cmp_ps(t2, tmin, _CMP_GT_OQ))));
+        __m256 ok = _mm256_or_ps(ok1, ok2);
+        int any = _mm256_movemask_ps(ok);
+        if (!any) continue;
+        __m256 t = _mm256_blendv_ps(inf, _mm256_blendv_ps(t2, t1, ok1), ok);
+        __m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        int lanes = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)) & any;
+        closest = _mm256_cvtss_f32(m);
+        best = i + __builtin_ctz(lanes);
+    }
+    return best;
+}
+
+#endif
+
+
+#endif
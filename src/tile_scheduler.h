@@ -0,0 +1,120 @@
+#ifndef TILESCHEDULERH
+#define TILESCHEDULERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A rectangle of pixels [x0,x1) x [y0,y1) that one worker renders as a unit.
+struct tile {
+    int x0, y0, x1, y1;
+};
+
+
+// Covers nx x ny with tiles of tile_size pixels on a side, clipped at the edges. A size below one
+// gives no tiles.
+std::vector<tile> make_tiles(int nx, int ny, int tile_size) {
+    std::vector<tile> tiles;
+    if (tile_size < 1) return tiles;
+    for (int y = 0; y < ny; y += tile_size) {
+        for (int x = 0; x < nx; x += tile_size) {
+            tile t;
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = (x + tile_size < nx) ? x + tile_size : nx;
+            t.y1 = (y + tile_size < ny) ? y + tile_size : ny;
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+
+int default_thread_count() {
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+
+// One job queue per worker. The owner pops from the back; thieves take from the front, so an owner
+// and a thief only contend when the queue is nearly empty.
+class work_queue {
+    public:
+        void push(int job) {
+            std::lock_guard<std::mutex> lock(m);
+            jobs.push_back(job);
+        }
+        bool pop(int& job) {
+            std::lock_guard<std::mutex> lock(m);
+            if (jobs.empty()) return false;
+            job = jobs.back();
+            jobs.pop_back();
+            return true;
+        }
+        bool steal(int& job) {
+            std::lock_guard<std::mutex> lock(m);
+            if (jobs.empty()) return false;
+            job = jobs.front();
+            jobs.pop_front();
+            return true;
+        }
+
+        std::mutex m;
+        std::deque<int> jobs;
+};
+
+
+// Runs fn(job, thread_index) for every job in [0, njobs) on nthreads workers. Each worker starts
+// with a contiguous block of jobs and steals from the others once its own queue runs dry. Jobs are
+// never created during the run, so a worker that finds every queue empty is done.
+template <typename F>
+void parallel_for_work_stealing(int njobs, int nthreads, F fn) {
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > njobs) nthreads = njobs > 0 ? njobs : 1;
+    std::vector<work_queue> queues(nthreads);
+    for (int t = 0; t < nthreads; t++) {
+        int begin = int((long long)njobs * t / nthreads);
+        int end = int((long long)njobs * (t+1) / nthreads);
+        // pushed in reverse so the owner walks its block front to back
+        for (int j = end-1; j >= begin; j--)
+            queues[t].push(j);
+    }
+
+    auto worker = [&](int self) {
+        int job;
+        for (;;) {
+            if (queues[self].pop(job)) {
+                fn(job, self);
+                continue;
+            }
+            bool stole = false;
+            for (int k = 1; k < nthreads && !stole; k++) {
+                stole = queues[(self + k) % nthreads].steal(job);
+            }
+            if (!stole) return;
+            fn(job, self);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; t++)
+        threads.push_back(std::thread(worker, t));
+    worker(0);
+    for (auto& th : threads)
+        th.join();
+}
+
+
+#endif
@@ -15,130 +15,171 @@
 #include <stdlib.h>
 #include <iostream>
 
+#if defined(RT_SIMD_VEC3) && (defined(__SSE2__) || defined(_M_X64))
+#define VEC3_SSE 1
+#include <emmintrin.h>
+#endif
+
+
+// The renderer's scalar type, picked at build time: float by default, double with
+// RT_DOUBLE_PRECISION (the RTWEEKEND_DOUBLE CMake option).
+#ifdef RT_DOUBLE_PRECISION
+typedef double real;
+#else
+typedef float real;
+#endif
+
 
-class vec3  {
+template <typename T>
+class vec3_t  {
     public:
-        vec3() {}
-        vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
-        inline float x() const { return e[0]; }
-        inline float y() const { return e[1]; }
-        inline float z() const { return e[2]; }
-        inline float r() const { return e[0]; }
-        inline float g() const { return e[1]; }
-        inline float b() const { return e[2]; }
+        typedef T value_type;
 
-        inline const vec3& operator+() const { return *this; }
-        inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        inline float operator[](int i) const { return e[i]; }
-        inline float& operator[](int i) { return e[i]; }
+        vec3_t() {}
+        vec3_t(T e0, T e1, T e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+        inline T x() const { return e[0]; }
+        inline T y() const { return e[1]; }
+        inline T z() const { return e[2]; }
+        inline T r() const { return e[0]; }
+        inline T g() const { return e[1]; }
+        inline T b() const { return e[2]; }
 
-        inline vec3& operator+=(const vec3 &v2);
-        inline vec3& operator-=(const vec3 &v2);
-        inline vec3& operator*=(const vec3 &v2);
-        inline vec3& operator/=(const vec3 &v2);
-        inline vec3& operator*=(const float t);
-        inline vec3& operator/=(const float t);
+        inline const vec3_t& operator+() const { return *this; }
+        inline vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+        inline T operator[](int i) const { return e[i]; }
+        inline T& operator[](int i) { return e[i]; }
 
-        inline float length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
-        inline float squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+        inline vec3_t& operator+=(const vec3_t &v2);
+        inline vec3_t& operator-=(const vec3_t &v2);
+        inline vec3_t& operator*=(const vec3_t &v2);
+        inline vec3_t& operator/=(const vec3_t &v2);
+        inline vec3_t& operator*=(const T t);
+        inline vec3_t& operator/=(const T t);
+
+        inline T length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
+        inline T squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
         inline void make_unit_vector();
 
-        float e[3];
+        T e[3];
 };
 
 
-inline std::istream& operator>>(std::istream &is, vec3 &t) {
+// Scalars are taken as the vector's value_type (a non-deduced context), so 2.0*v works for a
+// float vector just as it did before vec3 became a template.
+template <typename T>
+using vec3_scalar = typename vec3_t<T>::value_type;
+
+
+template <typename T>
+inline std::istream& operator>>(std::istream &is, vec3_t<T> &t) {
     is >> t.e[0] >> t.e[1] >> t.e[2];
     return is;
 }
 
-inline std::ostream& operator<<(std::ostream &os, const vec3 &t) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &os, const vec3_t<T> &t) {
     os << t.e[0] << " " << t.e[1] << " " << t.e[2];
     return os;
 }
 
-inline void vec3::make_unit_vector() {
-    float k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+template <typename T>
+inline void vec3_t<T>::make_unit_vector() {
+    T k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
     e[0] *= k; e[1] *= k; e[2] *= k;
 }
 
-inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
-    return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &v1, const vec3_t<T> &v2) {
+    return vec3_t<T>(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
 }
 
-inline vec3 operator-(const vec3 &v1, const vec3 &v2) {
-    return vec3(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &v1, const vec3_t<T> &v2) {
+    return vec3_t<T>(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
 }
 
-inline vec3 operator*(const vec3 &v1, const vec3 &v2) {
-    return vec3(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v1, const vec3_t<T> &v2) {
+    return vec3_t<T>(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
 }
 
-inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
-    return vec3(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
+template <typename T>
+inline vec3_t<T> operator/(const vec3_t<T> &v1, const vec3_t<T> &v2) {
+    return vec3_t<T>(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
 }
 
-inline vec3 operator*(float t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(vec3_scalar<T> t, const vec3_t<T> &v) {
+    return vec3_t<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline vec3 operator/(vec3 v, float t) {
-    return vec3(v.e[0]/t, v.e[1]/t, v.e[2]/t);
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, vec3_scalar<T> t) {
+    return vec3_t<T>(v.e[0]/t, v.e[1]/t, v.e[2]/t);
 }
 
-inline vec3 operator*(const vec3 &v, float t) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, vec3_scalar<T> t) {
+    return vec3_t<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline float dot(const vec3 &v1, const vec3 &v2) {
+template <typename T>
+inline T dot(const vec3_t<T> &v1, const vec3_t<T> &v2) {
     return v1.e[0] * v2.e[0]
          + v1.e[1] * v2.e[1]
          + v1.e[2] * v2.e[2];
 }
 
-inline vec3 cross(const vec3 &v1, const vec3 &v2) {
-    return vec3(v1.e[1] * v2.e[2] - v1.e[2] * v2.e[1],
-                v1.e[2] * v2.e[0] - v1.e[0] * v2.e[2],
-                v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]);
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &v1, const vec3_t<T> &v2) {
+    return vec3_t<T>(v1.e[1] * v2.e[2] - v1.e[2] * v2.e[1],
+                     v1.e[2] * v2.e[0] - v1.e[0] * v2.e[2],
+                     v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]);
 }
 
-inline vec3& vec3::operator+=(const vec3 &v){
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator+=(const vec3_t<T> &v){
     e[0] += v.e[0];
     e[1] += v.e[1];
     e[2] += v.e[2];
     return *this;
 }
 
-inline vec3& vec3::operator*=(const vec3 &v){
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator*=(const vec3_t<T> &v){
     e[0] *= v.e[0];
     e[1] *= v.e[1];
     e[2] *= v.e[2];
     return *this;
 }
 
-inline vec3& vec3::operator/=(const vec3 &v){
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator/=(const vec3_t<T> &v){
     e[0] /= v.e[0];
     e[1] /= v.e[1];
     e[2] /= v.e[2];
     return *this;
 }
 
-inline vec3& vec3::operator-=(const vec3& v) {
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator-=(const vec3_t<T>& v) {
     e[0] -= v.e[0];
     e[1] -= v.e[1];
     e[2] -= v.e[2];
     return *this;
 }
 
-inline vec3& vec3::operator*=(const float t) {
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator*=(const T t) {
     e[0] *= t;
     e[1] *= t;
     e[2] *= t;
     return *this;
 }
 
-inline vec3& vec3::operator/=(const float t) {
-    float k = 1.0f/t;
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator/=(const T t) {
+    T k = T(1)/t;
 
     e[0] *= k;
     e[1] *= k;
@@ -146,9 +187,119 @@ inline vec3& vec3::operator/=(const float t) {
     return *this;
 }
 
-inline vec3 unit_vector(vec3 v) {
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v) {
     return v / v.length();
 }
 
 
+#ifdef VEC3_SSE
+
+// 4-lane SSE layout for float vectors, opted into with RT_SIMD_VEC3. The fourth lane is padding
+// kept at zero. Every operation does the same IEEE operations in the same order as the generic
+// template (dot sums x, y, then z), so images do not change, only the instructions that make them.
+template <>
+class alignas(16) vec3_t<float>  {
+    public:
+        typedef float value_type;
+
+        vec3_t() {}
+        vec3_t(float e0, float e1, float e2) { store(_mm_setr_ps(e0, e1, e2, 0.0f)); }
+        explicit vec3_t(__m128 v) { store(v); }
+        inline __m128 load() const { return _mm_load_ps(e); }
+        inline void store(__m128 v) { _mm_store_ps(e, v); }
+
+        inline float x() const { return e[0]; }
+        inline float y() const { return e[1]; }
+        inline float z() const { return e[2]; }
+        inline float r() const { return e[0]; }
+        inline float g() const { return e[1]; }
+        inline float b() const { return e[2]; }
+
+        inline const vec3_t& operator+() const { return *this; }
+        inline vec3_t operator-() const { return vec3_t(_mm_xor_ps(load(), _mm_setr_ps(-0.0f, -0.0f, -0.0f, 0.0f))); }
+        inline float operator[](int i) const { return e[i]; }
+        inline float& operator[](int i) { return e[i]; }
+
+        inline vec3_t& operator+=(const vec3_t &v) { store(_mm_add_ps(load(), v.load())); return *this; }
+        inline vec3_t& operator-=(const vec3_t &v) { store(_mm_sub_ps(load(), v.load())); return *this; }
+        inline vec3_t& operator*=(const vec3_t &v) { store(_mm_mul_ps(load(), v.load())); return *this; }
+        inline vec3_t& operator/=(const vec3_t &v) {
+            store(_mm_and_ps(_mm_div_ps(load(), v.load()), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))));
+            return *this;
+        }
+        inline vec3_t& operator*=(const float t) { store(_mm_mul_ps(load(), _mm_set1_ps(t))); return *this; }
+        inline vec3_t& operator/=(const float t) { store(_mm_mul_ps(load(), _mm_set1_ps(1.0f/t))); return *this; }
+
+        inline float squared_length() const;
+        inline float length() const { return sqrtf(squared_length()); }
+        inline void make_unit_vector() { *this *= float(1.0 / sqrt(squared_length())); }
+
+        alignas(16) float e[4];
+};
+
+
+// Horizontal x+y+z of a lane-wise product, summed in the scalar order.
+inline float vec3_hsum3(__m128 m) {
+    __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+inline float vec3_t<float>::squared_length() const {
+    __m128 v = load();
+    return vec3_hsum3(_mm_mul_ps(v, v));
+}
+
+inline vec3_t<float> operator+(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    return vec3_t<float>(_mm_add_ps(v1.load(), v2.load()));
+}
+
+inline vec3_t<float> operator-(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    return vec3_t<float>(_mm_sub_ps(v1.load(), v2.load()));
+}
+
+inline vec3_t<float> operator*(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    return vec3_t<float>(_mm_mul_ps(v1.load(), v2.load()));
+}
+
+inline vec3_t<float> operator/(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    vec3_t<float> r(v1);
+    return r /= v2;
+}
+
+inline vec3_t<float> operator*(float t, const vec3_t<float> &v) {
+    return vec3_t<float>(_mm_mul_ps(_mm_set1_ps(t), v.load()));
+}
+
+inline vec3_t<float> operator*(const vec3_t<float> &v, float t) {
+    return vec3_t<float>(_mm_mul_ps(_mm_set1_ps(t), v.load()));
+}
+
+inline vec3_t<float> operator/(vec3_t<float> v, float t) {
+    return vec3_t<float>(_mm_div_ps(v.load(), _mm_set1_ps(t)));
+}
+
+inline float dot(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    return vec3_hsum3(_mm_mul_ps(v1.load(), v2.load()));
+}
+
+inline vec3_t<float> cross(const vec3_t<float> &v1, const vec3_t<float> &v2) {
+    __m128 a = v1.load(), b = v2.load();
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3_t<float>(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+}
+
+inline vec3_t<float> unit_vector(vec3_t<float> v) {
+    return v / v.length();
+}
+
+#endif
+
+
+typedef vec3_t<real> vec3;
+
+
 #endif
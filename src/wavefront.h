@@ -0,0 +1,193 @@
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <utility>
+#include <vector>
+#include "render.h"
+
+
+// Stream form of color(): every sample of a tile is a path in a queue, and each bounce runs as a
+// few flat loops over the whole queue instead of one deep recursion per sample. Each path carries
+// its own generator and ends by the same path_policy tests, so it draws the same random numbers
+// as it would in color() and the image matches the recursive integrator up to the order in which
+// attenuations are multiplied: 8-bit output is identical, but float output (pfm, raw) can differ
+// in the last bit. On sphere scenes it runs at the recursive integrator's speed, since
+// intersection dominates a bounce and scatter() gains little from batching (rtbench integrator_*).
+
+struct wavefront_path {
+    ray r;
+    vec3 throughput;
+    pcg32 rng;
+    sample_stream samples;
+    int slot;       // index of this sample in wavefront_queues::radiance
+    int depth;
+};
+
+
+struct wavefront_hit {
+    hit_record rec;
+    int path;
+};
+
+
+// Scratch space reused across tiles by one worker thread.
+struct wavefront_queues {
+    std::vector<wavefront_path> paths, next;
+    std::vector<wavefront_hit> hits[material_other+1];
+    std::vector<vec3> radiance;
+};
+
+
+// The qualified call lets the compiler inline the concrete scatter() into the batch loop;
+// material_other falls back to virtual dispatch.
+template <typename M>
+inline bool scatter_as(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation,
+                       ray& scattered) {
+    return static_cast<const M*>(m)->M::scatter(r_in, rec, attenuation, scattered);
+}
+
+template <>
+inline bool scatter_as<material>(const material *m, const ray& r_in, const hit_record& rec,
+                                 vec3& attenuation, ray& scattered) {
+    return m->scatter(r_in, rec, attenuation, scattered);
+}
+
+
+// Runs scatter() and the roulette test over one material bucket and queues the surviving paths
+// for the next bounce.
+template <typename M>
+void scatter_batch(wavefront_queues& q, const std::vector<wavefront_hit>& hits, const path_policy& policy) {
+    for (const wavefront_hit& h : hits) {
+        wavefront_path& p = q.paths[h.path];
+        std::swap(thread_rng(), p.rng);
+        std::swap(thread_samples(), p.samples);
+        vec3 attenuation;
+        ray scattered;
+        bool ok = scatter_as<M>(h.rec.mat_ptr, p.r, h.rec, attenuation, scattered);
+        vec3 next = p.throughput*attenuation;
+        if (ok) {
+            real survive = survival_probability(policy, p.depth+1, next);
+            if (survive < 1) {
+                if (random_double() >= survive) ok = false;
+                else next = next / survive;
+            }
+        }
+        std::swap(thread_samples(), p.samples);
+        std::swap(thread_rng(), p.rng);
+        if (ok) {
+            p.r = scattered;
+            p.throughput = next;
+            p.depth++;
+            q.next.push_back(p);
+        }
+        else {
+            RT_COUNT_DEPTH(p.depth+1);
+            q.radiance[p.slot] = vec3(0,0,0);
+        }
+    }
+}
+
+
+void render_tile_wavefront(const tile& t, const camera& cam, hitable *world,
+                           const render_settings& settings, framebuffer& fb, wavefront_queues& q,
+                           path_stats& stats) {
+    int ns = settings.ns;
+    int tw = t.x1 - t.x0;
+    q.paths.clear();
+    q.radiance.assign((t.x1 - t.x0) * (t.y1 - t.y0) * ns, vec3(0,0,0));
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            for (int s=0; s < ns; s++) {
+                wavefront_path p;
+                p.rng = rng_for_sample(j*fb.nx + i, s, settings.frame);
+                std::swap(thread_rng(), p.rng);
+                begin_sample(settings.sampling, i, j, s, settings.frame);
+                double jitter[2];
+                sample_2d(jitter);
+                real u = real(i + jitter[0]) / real(fb.nx);
+                real v = real(j + jitter[1]) / real(fb.ny);
+                p.r = cam.get_ray(u, v);
+                p.samples = thread_samples();
+                std::swap(thread_rng(), p.rng);
+                p.throughput = vec3(1,1,1);
+                p.slot = ((j - t.y0)*tw + (i - t.x0))*ns + s;
+                p.depth = 0;
+                q.paths.push_back(p);
+                stats.paths++;
+            }
+        }
+    }
+
+    while (!q.paths.empty()) {
+        // Intersect the whole queue, resolving misses against the sky and bucketing hits by material.
+        for (auto& h : q.hits)
+            h.clear();
+        stats.rays += q.paths.size();
+        for (int k = 0; k < int(q.paths.size()); k++) {
+            wavefront_path& p = q.paths[k];
+            wavefront_hit h;
+            if (p.depth == 0) RT_COUNT(primary_rays); else RT_COUNT(secondary_rays);
+            if (world->hit(p.r, 0.001, MAXFLOAT, h.rec)) {
+                RT_COUNT(material_hits[h.rec.mat_ptr->kind()]);
+                if (p.depth < settings.paths.max_depth) {
+                    h.path = k;
+                    q.hits[h.rec.mat_ptr->kind()].push_back(h);
+                }
+                else {
+                    RT_COUNT_DEPTH(p.depth+1);
+                    q.radiance[p.slot] = vec3(0,0,0);
+                }
+            }
+            else {
+                RT_COUNT_DEPTH(p.depth+1);
+                q.radiance[p.slot] = p.throughput * sky_color(p.r);
+            }
+        }
+
+        q.next.clear();
+        scatter_batch<lambertian>(q, q.hits[material_lambertian], settings.paths);
+        scatter_batch<metal>(q, q.hits[material_metal], settings.paths);
+        scatter_batch<dielectric>(q, q.hits[material_dielectric], settings.paths);
+        scatter_batch<material>(q, q.hits[material_other], settings.paths);
+        q.paths.swap(q.next);
+    }
+
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            const vec3 *samples = &q.radiance[((j - t.y0)*tw + (i - t.x0))*ns];
+            vec3 col(0, 0, 0);
+            for (int s=0; s < ns; s++)
+                col += samples[s];
+            fb.at(i, j) = col / real(ns);
+        }
+    }
+}
+
+
+path_stats render_wavefront(const camera& cam, hitable *world, const render_settings& settings, framebuffer& fb) {
+    std::vector<tile> tiles = make_tiles(fb.nx, fb.ny, settings.tile_size);
+    int nthreads = settings.threads < 1 ? 1 : settings.threads;
+    std::vector<wavefront_queues> queues(nthreads);
+    std::vector<path_stats> per_thread(nthreads);
+    parallel_for_work_stealing(int(tiles.size()), nthreads, [&](int job, int thread) {
+        RT_TIME_TILE(tiles[job]);
+        render_tile_wavefront(tiles[job], cam, world, settings, fb, queues[thread], per_thread[thread]);
+    });
+    path_stats total;
+    for (const path_stats& s : per_thread)
+        total.add(s);
+    return total;
+}
+
+
+#endif
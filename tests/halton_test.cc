@@ -0,0 +1,62 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// The scrambled Halton sampler must keep the sequence's stratification: in every pixel and every
+// dimension with prime base b, the first b^k samples land one in each interval of width 1/b^k.
+// Exits nonzero on failure.
+
+#include <stdio.h>
+#include <vector>
+#include "sampler.h"
+
+
+static const uint32_t primes[halton_sampler::num_primes] = {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+     59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311 };
+
+
+int main() {
+    const halton_sampler halton;
+    const uint32_t max_samples = 4096;
+    int failures = 0;
+    for (uint32_t frame = 0; frame < 2; frame++) {
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                for (int dim = 0; dim < halton_sampler::num_primes; dim++) {
+                    uint32_t base = primes[dim];
+                    for (uint32_t n = base; n <= max_samples; n *= base) {
+                        std::vector<char> hit(n, 0);
+                        bool ok = true;
+                        for (uint32_t s = 0; s < n && ok; s++) {
+                            double out[2];
+                            halton.sample_2d(x, y, s, frame, dim / 2, out);
+                            double v = out[dim % 2];
+                            // A sample whose remaining digits all scramble to zero sits exactly on
+                            // a stratum's lower edge, where v * n can round just below the integer;
+                            // distinct samples are far more than 1e-9 strata apart.
+                            uint32_t stratum = uint32_t(v * n + 1e-9);
+                            ok = v >= 0 && v < 1 && !hit[stratum];
+                            if (ok) hit[stratum] = 1;
+                        }
+                        if (!ok) {
+                            fprintf(stderr, "FAIL: pixel (%d,%d) frame %u dimension %d: the first %u samples "
+                                    "do not cover every 1/%u stratum\n", x, y, frame, dim, n, n);
+                            failures++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// load_obj on files that the parallel parser splits into several chunks: negative indices in a
+// chunk with no records of its own must still count back from the latest vertex, and corners
+// without a normal in a file with normals must get the face normal. Exits nonzero on failure.
+
+#include <stdio.h>
+#include <string>
+#include "mesh.h"
+
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int threads) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s (%d threads)\n", what, threads);
+        failures++;
+    }
+}
+
+
+static bool write_file(const char *path, const std::string& text) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    return (fclose(f) == 0) && ok;
+}
+
+
+// Six vertices, then enough comment lines to push the face past the first chunk.
+static std::string six_vertices_then_padding(bool normals) {
+    std::string text;
+    for (int k = 0; k < 6; k++) {
+        text += "v " + std::to_string(k) + " " + std::to_string(k % 2) + " " + std::to_string(k / 3) + "\n";
+        if (normals) text += "vn 0 0 " + std::to_string(k + 1) + "\n";
+    }
+    std::string comment = "# padding so that the face record lands in a later chunk of the file\n";
+    while (text.size() < 2500000)
+        text += comment;
+    return text;
+}
+
+
+int main() {
+    const char *path = "load_obj_test.obj";
+    // counts below one are clamped to one thread, as the renderer does
+    for (int threads : { -1, 0, 1, 4 }) {
+        std::string error;
+        triangle_mesh mesh;
+
+        bool loaded = write_file(path, six_vertices_then_padding(false) + "f -3 -2 -1\n")
+                   && load_obj(path, mesh, error, threads);
+        check(loaded, "negative position indices load", threads);
+        if (loaded) {
+            bool ok = mesh.indices.size() == 3;
+            for (int j = 0; ok && j < 3; j++)
+                ok = mesh.positions[mesh.indices[j]].x() == real(3 + j);
+            check(ok, "f -3 -2 -1 uses vertices 3, 4 and 5", threads);
+        }
+
+        mesh = triangle_mesh();
+        loaded = write_file(path, six_vertices_then_padding(true) + "f -3//-3 -2//-2 -1//-1\n")
+              && load_obj(path, mesh, error, threads);
+        check(loaded, "negative normal indices load", threads);
+        if (loaded) {
+            bool ok = mesh.indices.size() == 3 && mesh.normals.size() == mesh.positions.size();
+            for (int j = 0; ok && j < 3; j++)
+                ok = mesh.positions[mesh.indices[j]].x() == real(3 + j)
+                  && mesh.normals[mesh.indices[j]].z() == real(4 + j);
+            check(ok, "f -3//-3 -2//-2 -1//-1 uses vertices and normals 3, 4 and 5", threads);
+        }
+
+        // The first corner has a normal, the other two none: they take the face normal, +z for
+        // this counterclockwise triangle in the xy plane.
+        mesh = triangle_mesh();
+        loaded = write_file(path, "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 1 0 0\nf 1//1 2 3\n")
+              && load_obj(path, mesh, error, threads);
+        check(loaded, "faces mixing corners with and without normals load", threads);
+        if (loaded) {
+            bool ok = mesh.indices.size() == 3 && mesh.normals.size() == mesh.positions.size()
+                   && mesh.normals[mesh.indices[0]].x() == 1
+                   && mesh.normals[mesh.indices[1]].z() == 1 && mesh.normals[mesh.indices[2]].z() == 1;
+            check(ok, "corners without a normal get the face normal", threads);
+        }
+        if (!error.empty()) fprintf(stderr, "%s\n", error.c_str());
+    }
+    remove(path);
+    return failures ? 1 : 0;
+}